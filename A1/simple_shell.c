@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/wait.h>
@@ -5,140 +6,537 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <time.h>
 
+extern char **environ;
 
-/* Id is the PID of the process. Serial Id is the number used to forground the process. */
-struct Node {
-    int Id;
+
+/* One process of a job. Until it is reaped it is also linked into the pid_table bucket of its pid. */
+struct Proc {
+    int pid;
+    volatile sig_atomic_t done;
+    int status;                 // wait status, once done
+    struct Job *job;
+    struct Proc *next;
+};
+
+/*
+A pipeline started by the shell. Serial Id is the number used to forground a background job and its 
+index in job_table, a foreground job has serial Id 0 and is not in the table. running counts the 
+processes the SIGCHLD handler has not reaped yet.
+*/
+struct Job {
     int serialId;
-    struct Node* next;
+    int numProcs;
+    volatile sig_atomic_t running;
+    struct Proc *procs;
 };
 
 // built in commands
-char *commands[5];
+char *commands[7];
 int num_commands;
 
-// head/tail pointers for linked list
-struct Node *head = NULL;
-struct Node *tail;
+/* A command name found on PATH, kept in the bucket of its name's hash. */
+struct PathEntry {
+    char *name;
+    char *path;
+    int hits;
+    struct PathEntry *next;
+};
+
+#define PATH_BUCKETS 64
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+// command location cache, and the PATH it was filled from
+struct PathEntry *path_cache[PATH_BUCKETS];
+char *cached_path_var = NULL;
+
+#define PID_BUCKETS 256
+
+// most commands the parallel builtin runs at once, whatever -j asks for
+#define PARALLEL_MAX_SLOTS 1024
 
+// background jobs by serial Id, slot 0 is unused and the table grows as needed
+struct Job **job_table = NULL;
+int job_capacity = 0;
 int numJobs;
 
-// pid of the process running in the foreground
-int fg_process = 0;
+// processes that have not been reaped, hashed by pid
+struct Proc *pid_table[PID_BUCKETS];
 
-/* Remove any processes that have terminated from the linked list. */
-void clean_jobs() {
+// job running in the foreground
+struct Job *volatile fg_job = NULL;
 
-    struct Node *current = head;
-    struct Node *last_visited = NULL;
+// background jobs that finished since the job table was last cleaned
+volatile sig_atomic_t finished_jobs = 0;
 
-    while (current != NULL) {
+// set by Ctrl-C, so the parallel builtin stops starting commands
+volatile sig_atomic_t interrupted = 0;
 
-        int pid = current->Id;
+// SIGCHLD is blocked while the shell changes the job and pid tables, which the handler reads
+sigset_t chld_set;
 
-        // if current child is terminated
-        if (waitpid(pid, NULL, WNOHANG) !=0) {
+// signal mask commands start with
+sigset_t child_mask;
 
-            if (last_visited != NULL) {
-                last_visited->next = current->next;
-            }
-            else {
-                head = current->next;
-            }
+/* Remove a job from the job table if it is in it, and free it. */
+void freeJob(struct Job *job) {
+
+    if (job->serialId > 0) {
+        job_table[job->serialId] = NULL;
+        numJobs--;
+    }
+
+    free(job->procs);
+    free(job);
+}
+
+/* Free the background jobs that have finished. Only scans the table if the SIGCHLD handler saw one finish. */
+void cleanJobs() {
+
+    if (finished_jobs == 0) {
+        return;
+    }
+    finished_jobs = 0;
+
+    for (int i = 1; i < job_capacity; i++) {
+        if (job_table[i] != NULL && job_table[i]->running == 0) {
+            freeJob(job_table[i]);
+        }
+    }
+}
+
+/*
+SIGCHLD handler: reaps every child that has terminated as soon as it does, so none stay zombies, and 
+counts it off its job through the pid table. Jobs are freed outside of the handler, by cleanJobs.
+*/
+void chldHandler(int sig) {
 
-            //free(current);
+    int saved_errno = errno;
+    int pid, status;
 
-        } else {
-            last_visited = current;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
 
+        struct Proc **link = &pid_table[pid % PID_BUCKETS];
+
+        while (*link != NULL && (*link)->pid != pid) {
+            link = &(*link)->next;
+        }
+
+        if (*link == NULL) {
+            continue;
         }
 
-        current = current->next;
+        struct Proc *proc = *link;
+        *link = proc->next;
+        proc->status = status;
+        proc->done = 1;
+
+        if (--proc->job->running == 0 && proc->job->serialId > 0) {
+            finished_jobs++;
+        }
     }
 
-    tail = last_visited;
-    
+    errno = saved_errno;
 }
 
 void exitShell() {
 
     printf("Exiting the shell...\n");
-    struct Node *current = head;
-    struct Node *next;
 
     // terminate all child processes
-    while (current != NULL) {
-        kill(current->Id, SIGTERM);
-        current = current->next;
+    for (int i = 1; i < job_capacity; i++) {
+        struct Job *job = job_table[i];
+
+        if (job == NULL) {
+            continue;
+        }
+        for (int j = 0; j < job->numProcs; j++) {
+            if (!job->procs[j].done) {
+                kill(job->procs[j].pid, SIGTERM);
+            }
+        }
     }
 
     exit(0);
 }
 
-// fetches next command, returns the number of tokens recieved
-int getcmd(char *args[], int *bg) {
+/*
+Operator tokens. The tokenizer hands out these very strings for an unquoted |, > or &, so the rest of the 
+shell tells operators apart from words by comparing pointers, and a quoted "|" stays an ordinary word.
+*/
+char OP_PIPE[] = "|";
+char OP_REDIRECT[] = ">";
+char OP_BACKGROUND[] = "&";
+
+/*
+Storage for reading and parsing command lines, reused for every line of a session. The getline buffer, 
+the text of the words and the token array only grow when a line longer than any before it comes in, so 
+a long-running shell keeps a flat footprint.
+*/
+struct Arena {
+    char *line;         // getline buffer
+    size_t linecap;
+    char *text;         // the words, unquoted and '\0' terminated
+    size_t textCap;
+    char **args;        // the tokens, NULL terminated
+    size_t argsCap;
+};
+
+int isOperator(char c) {
+    return c == '|' || c == '>' || c == '&';
+}
+
+/*
+Split the length bytes in arena->line into tokens in one pass. Words are separated by whitespace (any 
+control character or space) and operators. Inside single quotes every character is literal; inside 
+double quotes a backslash only escapes " and \; elsewhere a backslash makes the next character literal. 
+Quotes can be mixed within a word. A word's text is never longer than the part of the line it came 
+from, so line length + 1 bytes of text and tokens always suffice. Returns the number of tokens, or -1 
+on an unterminated quote.
+*/
+int tokenize(struct Arena *arena, size_t length) {
 
-    int length;
-    char *loc, *tok;
-    int i = 0;
-    size_t linecap = 1024;
-    char *line = NULL;
+    if (arena->textCap < length + 1) {
+        arena->textCap = length + 1;
+        arena->text = (char *)realloc(arena->text, arena->textCap);
+    }
+    if (arena->argsCap < length + 2) {
+        arena->argsCap = length + 2;
+        arena->args = (char **)realloc(arena->args, arena->argsCap * sizeof(char *));
+    }
 
-    //line = (char *)malloc(linecap * sizeof(char));
+    const char *p = arena->line;
+    const char *end = p + length;
+    char *out = arena->text;
+    int n = 0;
 
-    printf("%s", ">> ");
-    length = getline(&line, &linecap, stdin);
+    while (1) {
 
-    while ((tok = strsep(&line, " \t\n")) != NULL) {
+        while (p < end && (unsigned char) *p <= ' ') {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
 
-        
-        for (int j=0; j < strlen(tok); j++) {
-            if (tok[j] <= 32) {
-                tok[j] = '\0';
-            }
+        if (isOperator(*p)) {
+            arena->args[n++] = *p == '|' ? OP_PIPE : *p == '>' ? OP_REDIRECT : OP_BACKGROUND;
+            p++;
+            continue;
         }
 
-        if (strlen(tok) > 0) {
-            args[i] = tok;
-            i++;
+        arena->args[n++] = out;
+
+        while (p < end && (unsigned char) *p > ' ' && !isOperator(*p)) {
+
+            if (*p == '\\') {
+                p++;
+                if (p < end) {
+                    *out++ = *p++;
+                }
+            }
+            else if (*p == '\'') {
+                p++;
+                while (p < end && *p != '\'') {
+                    *out++ = *p++;
+                }
+                if (p == end) {
+                    return -1;
+                }
+                p++;
+            }
+            else if (*p == '"') {
+                p++;
+                while (p < end && *p != '"') {
+                    if (*p == '\\' && p + 1 < end && (p[1] == '"' || p[1] == '\\')) {
+                        p++;
+                    }
+                    *out++ = *p++;
+                }
+                if (p == end) {
+                    return -1;
+                }
+                p++;
+            }
+            else {
+                *out++ = *p++;
+            }
         }
+
+        *out++ = '\0';
+    }
+
+    arena->args[n] = NULL;
+    return n;
+}
+
+/*
+Reads and parses the next command line into arena->args, returns the number of tokens. A & at the end 
+of the line sets bg and is removed. Exits the shell at the end of input.
+*/
+int getcmd(struct Arena *arena, int *bg) {
+
+    printf("%s", ">> ");
+    fflush(stdout);
+
+    ssize_t length = getline(&arena->line, &arena->linecap, stdin);
+
+    if (length == -1) {
+        printf("\n");
+        exitShell();
+    }
+
+    int i = tokenize(arena, length);
+
+    if (i < 0) {
+        fprintf(stderr, "Error: unterminated quote.\n");
+        return 0;
     }
 
     // If an '&' ended the line, then remove it from args and set bg to 1
-    if (i > 0 && strcmp(args[i-1], "&") == 0) {
+    if (i > 0 && arena->args[i-1] == OP_BACKGROUND) {
         *bg = 1;
         i--;
+        arena->args[i] = NULL;
     }
     else {
         *bg = 0;
     }
 
-    // This line is super suss
-    args[i] = NULL;
+    for (int j = 0; j < i; j++) {
+        if (arena->args[j] == OP_BACKGROUND) {
+            fprintf(stderr, "Error: & can only end a command line.\n");
+            return 0;
+        }
+    }
+
     return i;
 }
 
+/* A job with room for numProcs processes, added with addProc. SIGCHLD must be blocked. */
+struct Job *newJob(int numProcs) {
+
+    struct Job *job = (struct Job*)malloc(sizeof(struct Job));
+
+    job->serialId = 0;
+    job->numProcs = 0;
+    job->running = 0;
+    job->procs = (struct Proc*)malloc(numProcs * sizeof(struct Proc));
+
+    return job;
+}
+
+/*
+Record a process that was started for a job. SIGCHLD has to stay blocked from before the process was 
+started until here, or the handler could reap it before it is in the pid table.
+*/
+void addProc(struct Job *job, int pid) {
+
+    struct Proc *proc = &job->procs[job->numProcs++];
+
+    proc->pid = pid;
+    proc->done = 0;
+    proc->job = job;
+    proc->next = pid_table[pid % PID_BUCKETS];
+    pid_table[pid % PID_BUCKETS] = proc;
+
+    job->running++;
+}
+
+// Add a job to the job table under the lowest free serial Id
+void addJob(struct Job *job) {
+
+    int serialId = 1;
 
-// Add a new job to the linked list
-void addJob(int pid) {
+    while (serialId < job_capacity && job_table[serialId] != NULL) {
+        serialId++;
+    }
+
+    if (serialId >= job_capacity) {
+        int capacity = job_capacity > 0 ? 2 * job_capacity : 16;
+
+        job_table = (struct Job **)realloc(job_table, capacity * sizeof(struct Job *));
+        memset(job_table + job_capacity, 0, (capacity - job_capacity) * sizeof(struct Job *));
+        job_capacity = capacity;
+    }
 
+    job->serialId = serialId;
+    job_table[serialId] = job;
     numJobs++;
+}
+
+unsigned int hashName(const char *name) {
 
-    struct Node *newjob = (struct Node*)malloc(sizeof(struct Node));
-    newjob->Id = pid;
-    newjob->serialId = numJobs;
+    unsigned int hash = 5381;
 
-    if (head == NULL) {
-        head = newjob;
-        tail = newjob;
+    while (*name) {
+        hash = hash * 33 + (unsigned char) *name++;
     }
-    else {
-        tail->next = newjob;
-        tail = newjob;
+
+    return hash % PATH_BUCKETS;
+}
+
+/* Empty the command location cache. */
+void clearPathCache() {
+
+    for (int i = 0; i < PATH_BUCKETS; i++) {
+        struct PathEntry *entry = path_cache[i];
+
+        while (entry != NULL) {
+            struct PathEntry *next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+        path_cache[i] = NULL;
+    }
+}
+
+/* Forget where a command is, used when running it from its cached location failed. */
+void forgetPath(const char *name) {
+
+    struct PathEntry **link = &path_cache[hashName(name)];
+
+    while (*link != NULL) {
+        if (strcmp((*link)->name, name) == 0) {
+            struct PathEntry *entry = *link;
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+/*
+Returns the file to execute for a command, or NULL if it is not found. A name with a '/' is used as it 
+is, anything else is looked up in the cache and only searched for in the PATH directories the first time 
+(or after PATH changed, which empties the cache). Matches in relative PATH directories are not cached, 
+since they stop being right after a cd.
+*/
+const char *findCommand(const char *name) {
+
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+
+    const char *path_var = getenv("PATH");
+    if (path_var == NULL) {
+        path_var = DEFAULT_PATH;
+    }
+
+    if (cached_path_var == NULL || strcmp(cached_path_var, path_var) != 0) {
+        clearPathCache();
+        free(cached_path_var);
+        cached_path_var = strdup(path_var);
+    }
+
+    unsigned int bucket = hashName(name);
+
+    for (struct PathEntry *entry = path_cache[bucket]; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            entry->hits++;
+            return entry->path;
+        }
     }
+
+    static char *found = NULL;
+    size_t name_len = strlen(name);
+    const char *dir = path_var;
+
+    while (1) {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t) (end - dir) : strlen(dir);
+        struct stat st;
+
+        // an empty entry is the current directory
+        free(found);
+        found = (char *)malloc(dir_len + name_len + 3);
+        if (dir_len == 0) {
+            sprintf(found, "./%s", name);
+        }
+        else {
+            sprintf(found, "%.*s/%s", (int) dir_len, dir, name);
+        }
+
+        if (stat(found, &st) == 0 && S_ISREG(st.st_mode) && access(found, X_OK) == 0) {
+
+            if (found[0] != '/') {
+                return found;
+            }
+
+            struct PathEntry *entry = (struct PathEntry*)malloc(sizeof(struct PathEntry));
+            entry->name = strdup(name);
+            entry->path = found;
+            entry->hits = 1;
+            entry->next = path_cache[bucket];
+            path_cache[bucket] = entry;
+
+            found = NULL;
+            return entry->path;
+        }
+
+        if (end == NULL) {
+            return NULL;
+        }
+        dir = end + 1;
+    }
+}
+
+/* the hash builtin: list the cached command locations, or empty the cache with -r */
+void hashBuiltin(char **args) {
+
+    if (args[1] != NULL && strcmp(args[1], "-r") == 0) {
+        clearPathCache();
+        return;
+    }
+
+    int empty = 1;
+
+    for (int i = 0; i < PATH_BUCKETS; i++) {
+        for (struct PathEntry *entry = path_cache[i]; entry != NULL; entry = entry->next) {
+            if (empty) {
+                printf("hits\tcommand\n");
+                empty = 0;
+            }
+            printf("%4d\t%s\n", entry->hits, entry->path);
+        }
+    }
+
+    if (empty) {
+        printf("hash table empty\n");
+    }
+}
+
+/*
+Wait for every process of a job in the foreground, Ctrl-C kills all of them. SIGCHLD is blocked, the 
+handler does the reaping and sigsuspend returns after it ran.
+*/
+void waitJob(struct Job *job) {
+
+    sigset_t wait_mask;
+
+    sigprocmask(SIG_BLOCK, NULL, &wait_mask);
+    sigdelset(&wait_mask, SIGCHLD);
+
+    fg_job = job;
+
+    while (job->running > 0) {
+        sigsuspend(&wait_mask);
+    }
+
+    fg_job = NULL;
 }
 
+void parallelBuiltin(char **args);
+
 int builtInCmdHandler(char **args) {
 
     // Check if args[0] is a built in command
@@ -155,6 +553,8 @@ int builtInCmdHandler(char **args) {
     // 2 : pwd
     // 3 : jobs
     // 4 : fg
+    // 5 : hash
+    // 6 : parallel
 
     char path_name[100];   
 
@@ -169,24 +569,22 @@ int builtInCmdHandler(char **args) {
             break;
         case 3:
 
-            clean_jobs();
+            cleanJobs();
 
-            if (head == NULL) {printf("There are no jobs running.\n");}
+            if (numJobs == 0) {printf("There are no jobs running.\n");}
             else {
-                struct Node *current;
-                current = head;
-
                 printf("--------- Jobs ---------\n");
-                while (current != NULL) {
-                    printf("[%d]: %d\n", current->serialId, current->Id);
-                    current = current->next;
+                for (int i = 1; i < job_capacity; i++) {
+                    if (job_table[i] != NULL) {
+                        printf("[%d]: %d\n", i, job_table[i]->procs[0].pid);
+                    }
                 }
                 printf("------------------------\n");
             }    
             break;
         case 4:
 
-            // Job is the serial Id, so to obtain PID of job we must use current->Id
+            // Job is the serial Id, which indexes the job table
             
             // check that job was passed
             if (args[1] == NULL) {
@@ -194,135 +592,532 @@ int builtInCmdHandler(char **args) {
             }
 
             int job = atoi(args[1]);
-            if (job == 0) {
+            if (job <= 0 || job >= job_capacity || job_table[job] == NULL) {
                 break;
             }
 
-            struct Node *current;
-            current = head;
+            struct Job *current = job_table[job];
+            waitJob(current);
+            freeJob(current);
 
-            while (current != NULL) {
-                if (current->serialId == job) {
-                    fg_process = current->Id;
-                    waitpid(current->Id, NULL, 0);
-                    fg_process = 0;
+            break;
+        case 5:
+            hashBuiltin(args);
+            break;
+        case 6:
+            parallelBuiltin(args);
+            break;
+    }
 
-                    break;
-                }
-                current = current->next;
+    return 1;
+
+}
+
+/*
+Starts one command of a pipeline with posix_spawn, at the location findCommand resolved. glibc runs it 
+with vfork semantics, so the shell's page tables are not copied before the exec however large the shell 
+has grown. input and output are the pipe ends to use as stdin and stdout (-1 keeps the shell's) and a 
+'>' redirection becomes an open file action. The pipe fds are close-on-exec, so the command only keeps 
+the copies the file actions make. Returns the pid of the command, or -1 if it could not be started.
+*/
+int spawnStage(char *args[], int input, int output) {
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    struct sigaction ignore, saved;
+    sigset_t block, mask;
+    int pid, err;
+
+    posix_spawn_file_actions_init(&actions);
+
+    if (input >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, input, 0);
+    }
+    if (output >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, output, 1);
+    }
+
+    for (int i = 0; args[i] != NULL; i++) {
+        if (args[i] == OP_REDIRECT) {
+            args[i] = NULL;
+
+            if (args[i+1] == NULL) {
+                fprintf(stderr, "Error: no file to redirect to.\n");
+                posix_spawn_file_actions_destroy(&actions);
+                return -1;
             }
-            
+
+            posix_spawn_file_actions_addopen(&actions, 1, args[i+1], O_CREAT | O_WRONLY | O_APPEND, 0777);
+            break;
+        }
     }
 
-    return 1;
+    if (args[0] == NULL) {
+        fprintf(stderr, "Error: no command to run.\n");
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    /*
+    Commands ignore SIGINT, the shell kills the foreground pipeline itself on Ctrl-C. An ignored signal 
+    stays ignored across exec, so SIGINT is ignored in the shell while the command starts, and blocked 
+    so that a Ctrl-C in the meantime is handled once the handler is back. The command starts with the 
+    shell's original mask, without the SIGCHLD the shell blocks while it starts a pipeline.
+    */
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigprocmask(SIG_BLOCK, &block, &mask);
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &child_mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    ignore.sa_flags = 0;
+    sigaction(SIGINT, &ignore, &saved);
+
+    // a command that fails to start from where the cache says it is gets looked up once more
+    const char *path = findCommand(args[0]);
+    err = path ? posix_spawn(&pid, path, &actions, &attr, args, environ) : ENOENT;
+
+    if (err != 0 && path != NULL && path != args[0]) {
+        forgetPath(args[0]);
+        path = findCommand(args[0]);
+        err = path ? posix_spawn(&pid, path, &actions, &attr, args, environ) : ENOENT;
+    }
+
+    sigaction(SIGINT, &saved, NULL);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
 
+    if (err != 0) {
+        if (err == ENOENT && strchr(args[0], '/') == NULL) {
+            fprintf(stderr, "%s: command not found\n", args[0]);
+        }
+        else {
+            fprintf(stderr, "%s: %s\n", args[0], strerror(err));
+        }
+        return -1;
+    }
+
+    return pid;
 }
 
 /*
-Given two args arrays, this function creates a pipe and forks so that the output of the child
-is given as input to the parent. This function assumes that we are in a child of the shell.
+Given the args array, splits it at every '|' into the stages of a pipeline and runs the stages 
+concurrently: each stage is started straight from the shell with its stdin connected to the previous 
+stage's pipe and its stdout to the next one's, so data streams through the whole pipeline. The shell 
+closes its copies of the pipe ends as it goes so each reader sees end of file once its writer exits. 
+Returns the pipeline's job, which is not in the job table, or NULL if nothing could be started. Called 
+with SIGCHLD blocked.
 */
-void execCommandPipe(char *args1[], char *args2[]) {
+struct Job *startPipeline(char *args[], int numArgs) {
 
-    int pipefd[2];
-    int pid;
+    int numStages = 1;
+    for (int i = 0; i < numArgs; i++) {
+        if (args[i] == OP_PIPE) {
+            numStages++;
+        }
+    }
+
+    // one per '|', and a line can have any number of them, so not on the stack
+    char ***stages = (char ***)malloc(numStages * sizeof(char **));
+    int stage = 0;
+
+    stages[stage++] = args;
+    for (int i = 0; i < numArgs; i++) {
+        if (args[i] == OP_PIPE) {
+            args[i] = NULL;
+            stages[stage++] = args + i + 1;
+        }
+    }
+
+    for (int i = 0; i < numStages; i++) {
+        if (stages[i][0] == NULL) {
+            fprintf(stderr, "Error: empty command in pipeline.\n");
+            free(stages);
+            return NULL;
+        }
+    }
+
+    struct Job *job = newJob(numStages);
 
-    pipe(pipefd);
+    // read end of the pipe from the previous stage, -1 for the first stage
+    int input = -1;
 
-    pid = fork();
+    for (int i = 0; i < numStages; i++) {
 
-    if (pid == 0) {
+        int pipefd[2] = {-1, -1};
 
-        // redirect output to pipefd[1]
-        close(1);
-        dup2(pipefd[1], 1);
-        close(pipefd[0]);
-        close(pipefd[1]);
+        if (i < numStages - 1 && pipe2(pipefd, O_CLOEXEC) == -1) {
+            perror("pipe");
+            break;
+        }
+
+        int pid = spawnStage(stages[i], input, pipefd[1]);
+
+        if (input >= 0) {
+            close(input);
+        }
+        if (pipefd[1] >= 0) {
+            close(pipefd[1]);
+        }
+        input = pipefd[0];
 
-        if (execvp(args1[0], args1) == -1) {
-            exit(-1);
+        if (pid < 0) {
+            break;
         }
 
-    } else {
+        addProc(job, pid);
+    }
+
+    if (input >= 0) {
+        close(input);
+    }
+    free(stages);
+
+    if (job->numProcs == 0) {
+        freeJob(job);
+        return NULL;
+    }
+
+    return job;
+}
+
+/* Runs a command line: a builtin, or a pipeline that is waited for or added as a background job. */
+void execCommand(char *args[], int numArgs, int bg) {
+
+    if (builtInCmdHandler(args)) {
+        return;
+    }
+
+    struct Job *job = startPipeline(args, numArgs);
+
+    if (job == NULL) {
+        return;
+    }
+
+    if (bg == 0) {
+        waitJob(job);
+        freeJob(job);
+    } 
+    else {
+        addJob(job);
+    }   
+}
+
+/* Where the parallel builtin gets its commands from, and the command it is about to start. */
+struct ParallelInput {
+    char **command;     // the command given before :::
+    int commandLen;
+    char **items;       // the arguments after :::, one command each
+    FILE *file;         // or the file given with -f, one command line per line
+    struct Arena arena; // where its lines are read and parsed
+    char **argv;        // next command to start
+    int argc;
+    int argvCap;
+};
+
+void parallelAddArg(struct ParallelInput *in, char *arg) {
 
-        waitpid(pid, NULL, 0);
+    if (in->argc + 1 >= in->argvCap) {
+        in->argvCap = in->argvCap > 0 ? 2 * in->argvCap : 16;
+        in->argv = (char **)realloc(in->argv, in->argvCap * sizeof(char *));
+    }
+
+    in->argv[in->argc++] = arg;
+    in->argv[in->argc] = NULL;
+}
+
+/*
+Build the next command in in->argv. With ::: it is the command with the next item in place of every {}, 
+or appended if there is no {}. With -f it is the next non-empty line, parsed like a command line. Returns 0 when 
+there are no more commands.
+*/
+int parallelNext(struct ParallelInput *in) {
+
+    in->argc = 0;
+
+    if (in->file != NULL) {
+
+        while (in->argc == 0) {
+            ssize_t length = getline(&in->arena.line, &in->arena.linecap, in->file);
+
+            if (length == -1) {
+                return 0;
+            }
 
-        // redirect input to pipefd[0]
-        close(0);
-        dup2(pipefd[0], 0);
-        close(pipefd[0]);
-        close(pipefd[1]);
+            int n = tokenize(&in->arena, length);
 
-        if (execvp(args2[0], args2) == -1) {
-            exit(-1);
+            if (n < 0) {
+                fprintf(stderr, "Error: unterminated quote.\n");
+                continue;
+            }
+
+            // every command runs alongside the others anyway, a trailing & is dropped
+            if (n > 0 && in->arena.args[n-1] == OP_BACKGROUND) {
+                n--;
+            }
+
+            for (int i = 0; i < n; i++) {
+                parallelAddArg(in, in->arena.args[i]);
+            }
         }
 
+        return 1;
     }
+
+    if (*in->items == NULL) {
+        return 0;
+    }
+
+    char *item = *in->items++;
+    int replaced = 0;
+
+    for (int i = 0; i < in->commandLen; i++) {
+        if (strcmp(in->command[i], "{}") == 0) {
+            parallelAddArg(in, item);
+            replaced = 1;
+        }
+        else {
+            parallelAddArg(in, in->command[i]);
+        }
+    }
+
+    if (!replaced) {
+        parallelAddArg(in, item);
+    }
+
+    return 1;
+}
+
+/* The command line of in->argv as one string, for the report. */
+char *parallelLabel(struct ParallelInput *in) {
+
+    size_t length = 1;
+
+    for (int i = 0; i < in->argc; i++) {
+        length += strlen(in->argv[i]) + 1;
+    }
+
+    char *label = (char *)malloc(length);
+    label[0] = '\0';
+
+    for (int i = 0; i < in->argc; i++) {
+        if (i > 0) {
+            strcat(label, " ");
+        }
+        strcat(label, in->argv[i]);
+    }
+
+    return label;
+}
+
+double elapsedSeconds(struct timespec *start) {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
 }
 
 /*
-Given the args array, determines if there is a redirect or pipe and whether to run 
-process in background. In the case of a pipe, we call execCommandPipe(), which causes
-a second fork from the child process created in this method.
+The parallel builtin runs a list of commands, at most N at a time, starting the next one as soon as one 
+finishes, and reports how each one exited and the total wall time:
+
+    parallel [-j N] command [args] ::: item ...     runs the command once per item
+    parallel [-j N] -f file                         runs every line of the file as a command line
+
+N defaults to the number of CPUs and is capped at the number of items and at PARALLEL_MAX_SLOTS. The 
+commands are jobs of the shell like any other (their processes are reaped by the SIGCHLD handler), they 
+are just not put in the job table. Ctrl-C kills the running ones and stops starting new ones. Called 
+with SIGCHLD blocked.
 */
-void execCommand(char *args[], int numArgs, int bg) {
+void parallelBuiltin(char **args) {
 
-    int redirect = -1;
-    int pipe_ = -1;
-    
-    for (int i = 0; i<numArgs; i++) {
-        if (strcmp(args[i], ">") == 0) {
-            redirect = i;
-        }   
-        else if (strcmp(args[i], "|") == 0) {
-            pipe_ = i;
+    struct ParallelInput in;
+    int slots = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    char *path = NULL;
+    int i = 1;
+
+    memset(&in, 0, sizeof(in));
+
+    while (args[i] != NULL && args[i][0] == '-') {
+        if (strcmp(args[i], "-j") == 0 && args[i+1] != NULL) {
+            slots = atoi(args[i+1]);
+            i += 2;
+        }
+        else if (strcmp(args[i], "-f") == 0 && args[i+1] != NULL) {
+            path = args[i+1];
+            i += 2;
+        }
+        else {
+            break;
+        }
+    }
+
+    in.command = args + i;
+    while (args[i] != NULL && strcmp(args[i], ":::") != 0) {
+        i++;
+    }
+    in.commandLen = args + i - in.command;
+
+    if (slots < 1 || (path == NULL) == (args[i] == NULL) || (path == NULL) == (in.commandLen == 0)) {
+        fprintf(stderr, "usage: parallel [-j N] command [args] ::: item ...\n");
+        fprintf(stderr, "       parallel [-j N] -f file\n");
+        return;
+    }
+
+    if (path != NULL) {
+        in.file = fopen(path, "r");
+        if (in.file == NULL) {
+            perror(path);
+            return;
         }
     }
+    else {
+        in.items = args + i + 1;
 
-    if (!builtInCmdHandler(args)) {
-        int pid = fork();
+        // no more slots than commands
+        int items = 0;
+        while (in.items[items] != NULL && items < slots) {
+            items++;
+        }
+        slots = items > 0 ? items : 1;
+    }
+
+    if (slots > PARALLEL_MAX_SLOTS) {
+        slots = PARALLEL_MAX_SLOTS;
+    }
 
-        if (pid == 0) {
+    struct Job **running = (struct Job **)calloc(slots, sizeof(struct Job *));
+    char **labels = (char **)malloc(slots * sizeof(char *));
+    int *numbers = (int *)malloc(slots * sizeof(int));
+    int active = 0, started = 0, failed = 0;
+    int more = 1;
+    struct timespec start;
+    sigset_t wait_mask;
 
-            // Make child ignore SIGINT
-            signal(SIGINT, SIG_IGN);
+    sigprocmask(SIG_BLOCK, NULL, &wait_mask);
+    sigdelset(&wait_mask, SIGCHLD);
 
-            // Check if pipe was indicated
-            if (pipe_ >= 0) {
-                args[pipe_] = NULL;
-                execCommandPipe(args, args + pipe_ + 1);
+    interrupted = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (1) {
+
+        // fill every free slot
+        while (more && !interrupted && active < slots) {
+
+            more = parallelNext(&in);
+            if (!more) {
+                break;
             }
 
-            // redirect output if indicated
-            if (redirect >= 0) {
-                args[redirect] = NULL;
-                close(1);
-                int fd = open(args[redirect+1], O_CREAT | O_WRONLY | O_APPEND, 0777);
+            // the label is made first, starting the pipeline cuts argv up at its | and >
+            char *label = parallelLabel(&in);
+            struct Job *job = startPipeline(in.argv, in.argc);
+
+            started++;
+
+            if (job == NULL) {
+                printf("[%d] not started: %s\n", started, label);
+                fflush(stdout);
+                free(label);
+                failed++;
+                continue;
             }
 
-            if (execvp(args[0], args) == -1) {
-                exit(-1);                    
-            } 
+            int slot = 0;
+            while (running[slot] != NULL) {
+                slot++;
+            }
+
+            running[slot] = job;
+            labels[slot] = label;
+            numbers[slot] = started;
+            active++;
         }
 
-        else {
-            if (bg == 0) {
-                fg_process = pid;
-                waitpid(pid, NULL, 0);
-                fg_process = 0;
-            } 
+        if (active == 0) {
+            break;
+        }
+
+        sigsuspend(&wait_mask);
+
+        for (int slot = 0; slot < slots; slot++) {
+
+            struct Job *job = running[slot];
+
+            if (job == NULL) {
+                continue;
+            }
+
+            if (interrupted) {
+                for (int j = 0; j < job->numProcs; j++) {
+                    if (!job->procs[j].done) {
+                        kill(job->procs[j].pid, SIGKILL);
+                    }
+                }
+            }
+
+            if (job->running > 0) {
+                continue;
+            }
+
+            // a pipeline exits with the status of its last command
+            int status = job->procs[job->numProcs - 1].status;
+
+            if (WIFEXITED(status)) {
+                printf("[%d] exit %d: %s\n", numbers[slot], WEXITSTATUS(status), labels[slot]);
+                failed += WEXITSTATUS(status) != 0;
+            }
             else {
-                addJob(pid);
-            }   
+                printf("[%d] signal %d: %s\n", numbers[slot], WTERMSIG(status), labels[slot]);
+                failed++;
+            }
+            fflush(stdout);
+
+            freeJob(job);
+            free(labels[slot]);
+            running[slot] = NULL;
+            active--;
         }
     }
+
+    printf("parallel: %d commands, %d failed, %.3f s\n", started, failed, elapsedSeconds(&start));
+
+    if (in.file != NULL) {
+        fclose(in.file);
+    }
+    free(in.arena.line);
+    free(in.arena.text);
+    free(in.arena.args);
+    free(in.argv);
+    free(running);
+    free(labels);
+    free(numbers);
 }
 
 // Control C signal handler
 void sigHandler(int sig) {
-    if (fg_process > 0) {
-        kill(fg_process, SIGKILL);
-    } 
+
+    struct Job *job = fg_job;
+
+    interrupted = 1;
+
+    if (job == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < job->numProcs; i++) {
+        if (!job->procs[i].done) {
+            kill(job->procs[i].pid, SIGKILL);
+        }
+    }
 }
 
 int main() {
@@ -333,11 +1128,15 @@ int main() {
     commands[2] = "pwd";
     commands[3] = "jobs";
     commands[4] = "fg";
-    num_commands = 5;
+    commands[5] = "hash";
+    commands[6] = "parallel";
+    num_commands = 7;
 
-    char *args[20];
+    struct Arena arena;
     int numArgs;
 
+    memset(&arena, 0, sizeof(arena));
+
     numJobs = 0;
 
     int bg;
@@ -350,11 +1149,29 @@ int main() {
     // ignore command z
     signal(SIGTSTP, SIG_IGN);
 
+    // reap children as soon as they terminate
+    struct sigaction chld;
+    chld.sa_handler = chldHandler;
+    sigemptyset(&chld.sa_mask);
+    chld.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+
+    if (sigaction(SIGCHLD, &chld, NULL) == -1) {
+        printf("Error: Could not bind signal handler.\n");
+        exit(1);
+    }
+
+    sigemptyset(&chld_set);
+    sigaddset(&chld_set, SIGCHLD);
+    sigprocmask(SIG_SETMASK, NULL, &child_mask);
+
     while (1) {
-        numArgs = getcmd(args, &bg);
+        numArgs = getcmd(&arena, &bg);
 
         if (numArgs > 0) {
-            execCommand(args, numArgs, bg);
+            sigprocmask(SIG_BLOCK, &chld_set, NULL);
+            cleanJobs();
+            execCommand(arena.args, numArgs, bg);
+            sigprocmask(SIG_UNBLOCK, &chld_set, NULL);
         }    
     }
 
@@ -1,26 +1,83 @@
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <pthread.h>
-#include "queue.h"
 #include "sut.h"
-#include <ucontext.h>
+#include "SimpleThreadScheduler.h"
+#include "sut_context.h"
 #include <fcntl.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <link.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define SUT_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#endif
 
 typedef struct threaddesc
 {
 	int threadid;
 	char *threadstack;
+	size_t stack_size;
 	void *threadfunc;
-	ucontext_t threadcontext;
+	sut_context threadcontext;
+	struct threaddesc *next;        // intrusive link, used while the task sits on an overflow list or timer wheel slot
+	int io_result;                  // completion slot, IEXEC stores the result of the task's IO request here
+	int io_errno;                   // and the errno that came with it
+	atomic_flag io_guard;           // protects io_parked and the done flags of the task's async requests
+	bool io_parked;                 // parked in sut_wait_any/sut_wait_all, the next completion wakes it
+	unsigned long long wake_tick;   // when a sleeping task is due, in timer wheel ticks
+	int base_priority;              // priority class the task was created with
+	int priority;                   // current feedback queue level, never above base_priority
+	long long level_ns;             // run time used on the current level
+	void *arg;                      // argument of a task started with sut_spawn
+	struct sut_handle *handle;      // and where its result goes, NULL for sut_create tasks
+	volatile int preempt_disable;   // the task must not be preempted while this is above 0
+	volatile bool preempt_pending;  // its quantum ran out meanwhile, yield when preempt_disable drops to 0
+	long preemptions;               // quantum statistics, see sut_task_preempt_stats
+	long overruns;
+	long long overrun_ns;
+	long long max_overrun_ns;
+	long long ready_ns;             // when the task was last made ready, with collect_stats or tracing
+	long long io_submit_ns;         // when it handed its blocking IO call to the executor, 0 if it did not
+	struct executor *last_executor; // where the task last ran, it is made ready there again to keep its cache warm
 } threaddesc;
 
+/* shared by a spawned task and whoever joins it, freed by the second of the two to let go */
+struct sut_handle
+{
+    sut_future result;
+    atomic_int refs;
+};
+
 #define OPEN 0
 #define CLOSE 1
 #define READ 2
 #define WRITE 3
+#define READV 4
+#define WRITEV 5
+
+// mbind policy, from linux/mempolicy.h
+#define MPOL_PREFERRED 1
+
+// how sut_open opens files, shared by both IO engines
+#define OPEN_FLAGS (O_RDWR | O_APPEND | O_CREAT)
+#define OPEN_MODE 0777
 
 typedef struct IOrequest
 {
@@ -28,379 +85,3420 @@ typedef struct IOrequest
     char *file;
     char *buffer;
     int buffer_size;
+    const struct iovec *iov;        // buffers of a READV or WRITEV
+    int iovcnt;
     int file_descriptor;
-    struct queue_entry * task;
+    long long timeout_ns;           // give up on a read or write after this long, 0 waits forever
+    bool async;                     // from sut_read_async/sut_write_async, the result stays in the request
+    bool done;                      // async request has completed, under task->io_guard
+    int result;
+    int error;
+    struct sut_io_op *op;           // where sut_submit_batch wants the result
+    long long queued_ns;            // when it went on IOqueue, with collect_stats or tracing
+    struct threaddesc * task;
+    struct IOrequest *next;         // intrusive link for IOqueue and the free lists
+#ifdef SUT_HAVE_IO_URING
+    struct __kernel_timespec timeout;
+#endif
 } IOrequest;
 
+#define REQUEST_SLAB_SIZE 64
 
-typedef struct IOresult
+// requests sut_submit_batch queues at a time
+#define BATCH_CHUNK 64
+
+// with coalesce_writes, queued writes up to this size to the same fd are merged into one writev of at most
+// COALESCE_MAX_IOV buffers
+#define COALESCE_MAX_WRITE 4096
+#define COALESCE_MAX_IOV 64
+
+/* IO requests are carved out of slabs, which are only freed at shutdown */
+typedef struct request_slab
 {
-    int action;
-    int result;
-} IOresult;
+    struct request_slab *next;
+    IOrequest requests[REQUEST_SLAB_SIZE];
+} request_slab;
+
+/* actions a C-executor finishes on behalf of a task once the task's context has been saved */
+#define POST_NONE 0
+#define POST_REQUEUE 1
+#define POST_SUBMIT_IO 2
+#define POST_EXIT 3
+#define POST_SLEEP 4
+#define POST_PARK 5
+#define POST_PREEMPT 6
+
+#define CACHE_LINE 64
+
+/* slot of a ready queue ring, sequence tells producers and consumers whose turn the slot is */
+typedef struct ready_cell
+{
+    atomic_size_t sequence;
+    threaddesc *task;
+} ready_cell;
+
+/*
+Lock-free multi-producer/multi-consumer ready queue (a bounded ring of descriptor pointers, as in Vyukov's
+MPMC queue). Pushing or popping a task is a CAS on one of the two positions and takes no lock or allocation.
+When the ring is full, tasks spill onto an overflow list chained through threaddesc->next, which is the only
+part of the queue protected by a mutex.
+*/
+typedef struct readyqueue
+{
+    ready_cell *cells;
+    size_t mask;
+    _Alignas(CACHE_LINE) atomic_size_t enqueue_pos;
+    _Alignas(CACHE_LINE) atomic_size_t dequeue_pos;
+    _Alignas(CACHE_LINE) atomic_int overflow_count;
+    pthread_mutex_t overflow_lock;
+    threaddesc *overflow_head;
+    threaddesc *overflow_tail;
+} readyqueue;
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+/*
+Hierarchical timer wheel of sleeping tasks, owned by one executor. Level 0 has a slot per tick for the next
+WHEEL_SIZE ticks, each level above covers WHEEL_SIZE times the span of the one below, and a slot of a higher
+level is cascaded down as the wheel reaches it. Tasks are linked into slots through threaddesc->next.
+*/
+typedef struct timer_wheel
+{
+    threaddesc *slots[WHEEL_LEVELS][WHEEL_SIZE];
+    unsigned long long current_tick;    // every tick before this one has been processed
+    long count;
+} timer_wheel;
+
+/* log2 latency histogram, updated by one thread at a time with plain relaxed stores */
+typedef struct histogram
+{
+    atomic_long count;
+    atomic_llong total_ns;
+    atomic_llong max_ns;
+    atomic_long buckets[SUT_HIST_BUCKETS];
+} histogram;
 
-int numthreads;
+// kinds of trace events besides the POST_* action a run ended with
+#define TRACE_IDLE 16
+#define TRACE_IO 17
 
-struct queue readyqueue;
-struct queue IOqueue;
-struct queue IOoutqueue;
+// events each thread can record before it starts dropping them
+#define TRACE_EVENTS 65536
 
-//threaddesc *current_descriptor;
+typedef struct trace_event
+{
+    long long start_ns;
+    long long duration_ns;
+    int task;
+    int kind;           // POST_* for a run, TRACE_IDLE, or TRACE_IO + the request's action
+} trace_event;
+
+/* events recorded by one thread, only written by that thread and read at shutdown */
+typedef struct trace_buffer
+{
+    trace_event *events;
+    long count;
+    long dropped;
+} trace_buffer;
+
+/*
+Each C-executor owns a local ready queue per priority level. Tasks created or yielded on an executor are
+pushed onto its own queues, and an executor whose queues are empty steals from the others.
+
+The fields a switch touches come first and share one cache line; the ones other threads write (the ready queue
+indices, the idle handshake) are on lines of their own so that waking an executor does not invalidate it.
+*/
+typedef struct executor
+{
+    threaddesc *volatile running;   // task switched to right now, NULL while the scheduler loop runs
+    sut_context context;            // the scheduler loop's own context
+    int post_switch;
+    void *post_switch_arg;
+    volatile long long dispatch_ns; // when running was switched to
+    long long next_aging;
+    atomic_long switches;           // scheduler metrics, see sut_stats, written only by this executor
+    atomic_long yields;
+    int id;
+    int cpu;                        // CPU the executor is pinned to, -1 if it is not
+    int numa_node;                  // node it runs on, -1 if unknown
+    threaddesc *free_tasks;         // recycled descriptors (with their stacks), only touched by this executor
+    int num_free_tasks;
+    IOrequest *free_requests;       // IO requests ready for reuse, only touched by this executor
+    request_slab *request_slabs;
+    atomic_long io_requests;        // counters, written only by this executor
+    atomic_long request_slabs_allocated;
+    pthread_t thread;
+    _Alignas(CACHE_LINE) atomic_bool sleeping;
+    bool wakeup;
+    pthread_mutex_t idle_lock;      // an idle executor waits on idle_cond until wakeup is set or a timer is due
+    pthread_cond_t idle_cond;
+    readyqueue runqueue[SUT_NUM_PRIORITIES];
+    timer_wheel timers;             // tasks sleeping on this executor, only touched by it
+    timer_t preempt_timer;
+    atomic_long preemptions;
+    atomic_long overruns;
+    atomic_llong overrun_ns;
+    atomic_llong max_overrun_ns;
+    histogram run_time;
+    histogram ready_wait;
+    histogram io_round_trip;
+    trace_buffer trace;
+} executor;
+
+atomic_int numthreads;
+
+// requests waiting for IEXEC, linked through IOrequest->next and protected by iexec_mutex
+IOrequest *IOqueue_head;
+IOrequest *IOqueue_tail;
 
 // kernel threads
-pthread_t* cexec;
-pthread_t* cexec2;
-pthread_t* iexec;
+executor *cexecs;
+int num_c_execs;
+pthread_t *iexecs;
+int num_i_execs;
 
-// cexec and iexec mutex
-pthread_mutex_t cexec_mutex = PTHREAD_MUTEX_INITIALIZER;
+// iexec mutex, iexec_cond is signalled when IOqueue gets a request or the last task exits
 pthread_mutex_t iexec_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t iexec_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+Runtime state of the calling kernel thread: the executor of a C-executor thread (NULL on any other thread), and
+the trace buffer of every thread that records events. Initial-exec TLS, so a read is one load off the thread
+pointer and is safe in the preemption signal handler.
+*/
+static __thread executor *thread_executor __attribute__((tls_model("initial-exec")));
+static __thread trace_buffer *thread_trace __attribute__((tls_model("initial-exec")));
+
+/*
+A task may be resumed on another kernel thread after any switch, so task code must not reuse a thread-local
+address the compiler worked out before the switch. It reads its executor through this function, which is kept
+out of line (and out of interprocedural analysis) so every call loads the pointer afresh. The scheduler loop
+never migrates and keeps its executor in a local.
+*/
+#if defined(__clang__)
+#define NO_TLS_CACHE __attribute__((noinline))
+#else
+#define NO_TLS_CACHE __attribute__((noinline, noipa))
+#endif
+
+static NO_TLS_CACHE executor *this_executor() {
+    return thread_executor;
+}
+
+/* task running on the calling kernel thread, NULL outside of a task */
+static inline threaddesc *current_task() {
 
-/* pthread variable to keep track of cexec contexts */
-pthread_key_t context_key;
+    executor *exec = this_executor();
 
-/* pthread variable to keep track of current context running on a kernel thread */
-pthread_key_t current_descriptor_key;
+    return exec ? exec->running : NULL;
+}
 
-#define MAX_THREADS                        32
 #define THREAD_STACK_SIZE                  1024*64
+#define TASK_CACHE_SIZE                    64
+#define MLFQ_QUANTUM_NS                    2000000LL
+#define AGING_INTERVAL_NS                  100000000LL
+#define TIMER_TICK_NS                      1000000LL
+#define IDLE_WAIT_NS                       100000000LL
+#define READY_QUEUE_SIZE                   256
+#define IO_URING_ENTRIES                   256
+
+// used to spread tasks made ready outside of a C-executor over all executors
+atomic_uint next_executor;
+
+// number of executors blocked in executor_idle
+atomic_int idle_executors;
+
+// whether the thread pool IEXEC merges runs of small writes to one fd
+bool coalesce_writes;
+
+// preemption is on when the quantum is above 0, the timer fires PREEMPT_TICKS times per quantum
+#define PREEMPT_TICKS 4
+#define PREEMPT_SIGNAL (SIGRTMIN + 3)
+long long preempt_quantum_ns;
+
+// sut_stats histograms are only filled in with collect_stats, the trace only with a trace_path
+bool collect_stats;
+const char *trace_path;
+long long trace_epoch;
+bool timing;                    // either of them, tasks and requests get timestamped
+
+// time requests waited on IOqueue, updated under iexec_mutex
+histogram ioqueue_wait;
+
+// one trace buffer per IEXEC, found through thread_trace on the IEXEC's own thread
+trace_buffer *iexec_traces;
+
+// unique task ids for the trace and sut_stats
+atomic_int next_task_id;
+
+// slots per ready queue, the executors set up their own queues once they are running on their CPU
+int ready_queue_size;
+
+// CPUs to pin executors to, NULL to let the OS place them
+int *cexec_cpus;
+int num_cexec_cpus;
+int *iexec_cpus;
+int num_iexec_cpus;
+
+// sut_init_config waits here until every executor has set up its queues
+pthread_barrier_t executors_ready;
+// held while the executors are created, the barrier needs to know how many of them started
+pthread_mutex_t executors_starting = PTHREAD_MUTEX_INITIALIZER;
+
+atomic_bool shutdown;
+
+// multi-level feedback queue: run time allowed on level 0 (doubling per level) and how often tasks are aged
+long long mlfq_quantum_ns;
+long long aging_interval_ns;
+
+// descriptors recycled by executors whose own free list is full, shared by all threads
+pthread_mutex_t task_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+threaddesc *task_pool;
+int task_pool_size;
+
+// how many descriptors each executor keeps for reuse, and how their stacks are allocated
+int task_cache_size;
+bool stack_guard;
+int stack_mode;
+size_t stack_size;
+size_t page_size;
+
+// task descriptors that had to come from malloc, sut_create can run on any thread
+atomic_long tasks_allocated;
+
+#ifdef SUT_HAVE_IO_URING
+/*
+State of the io_uring IO engine. The submission and completion rings are shared with the kernel, and the
+engine keeps a read of wakefd armed in the ring at all times so that a C-executor adding to IOqueue can wake
+the IEXEC thread while it waits in io_uring_enter.
+*/
+typedef struct uring
+{
+    int fd;
+    int wakefd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    unsigned cq_entries;
+    struct io_uring_cqe *cqes;
+    unsigned in_flight;
+    bool wake_armed;
+    uint64_t wake_buffer;
+    atomic_bool sleeping;
+} uring;
+
+uring ring;
+
+// user_data of the wakefd read and of link timeouts, real requests carry their IOrequest pointer
+#define URING_WAKE_TOKEN 0
+#define URING_TIMEOUT_TOKEN 1
+#endif
+
+bool uring_active;
+
+static void readyqueue_init(readyqueue *q, size_t size) {
+
+    // the ring indexes with a mask, so round the size up to a power of two
+    size_t capacity = 2;
+    while (capacity < size) {
+        capacity <<= 1;
+    }
 
-// the number of cexec threads to run (can be either 1 or 2)
-#define num_c_execs 1
+    q->cells = (ready_cell *) malloc(capacity * sizeof(ready_cell));
+    q->mask = capacity - 1;
 
-bool shutdown;
-bool readyqueue_empty;
-bool IOqueue_empty;
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&q->cells[i].sequence, i);
+    }
 
-/* tell the kernel threads that shutdown has been called and wait for them to terminate */
-void sut_shutdown() {
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    atomic_init(&q->overflow_count, 0);
 
-    shutdown = true;
+    pthread_mutex_init(&q->overflow_lock, NULL);
+    q->overflow_head = NULL;
+    q->overflow_tail = NULL;
+}
+
+/* release a ready queue's ring, it has to be empty */
+static void readyqueue_destroy(readyqueue *q) {
+
+    free(q->cells);
+    q->cells = NULL;
+    pthread_mutex_destroy(&q->overflow_lock);
+}
+
+/* try to put a task in the ring, false if it is full */
+static bool ring_enqueue(readyqueue *q, threaddesc *task) {
 
-    pthread_join(*cexec, NULL);
+    ready_cell *cell;
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
 
-    if (num_c_execs == 2) {
-        pthread_join(*cexec2, NULL);
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
     }
 
-    pthread_join(*iexec, NULL);
+    cell->task = task;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return true;
 }
 
-void sut_yield() {
+/* try to take the oldest task from the ring, NULL if it is empty */
+static threaddesc *ring_dequeue(readyqueue *q) {
+
+    ready_cell *cell;
+    threaddesc *task;
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
 
-    struct threaddesc * current_descriptor = pthread_getspecific(current_descriptor_key);
-    getcontext(&current_descriptor->threadcontext);
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t dif = (intptr_t) seq - (intptr_t) (pos + 1);
 
-    struct queue_entry* task = queue_new_node(current_descriptor);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
 
-    pthread_mutex_lock(&cexec_mutex);
-    queue_insert_tail(&readyqueue, task);
-    pthread_mutex_unlock(&cexec_mutex);
+    task = cell->task;
+    atomic_store_explicit(&cell->sequence, pos + q->mask + 1, memory_order_release);
+    return task;
+}
+
+static void readyqueue_push(readyqueue *q, threaddesc *task) {
 
-    swapcontext(&current_descriptor->threadcontext, pthread_getspecific(context_key));
+    // once tasks have spilled over, newer ones queue up behind them to keep the order FIFO
+    if (atomic_load_explicit(&q->overflow_count, memory_order_acquire) == 0 && ring_enqueue(q, task)) {
+        return;
+    }
 
+    pthread_mutex_lock(&q->overflow_lock);
+    task->next = NULL;
+    if (q->overflow_tail) {
+        q->overflow_tail->next = task;
+    } else {
+        q->overflow_head = task;
+    }
+    q->overflow_tail = task;
+    atomic_fetch_add(&q->overflow_count, 1);
+    pthread_mutex_unlock(&q->overflow_lock);
 }
 
-void sut_exit() {
+/* pop the oldest task from a ready queue, NULL if it is empty */
+static threaddesc *readyqueue_pop(readyqueue *q) {
+
+    threaddesc *task = ring_dequeue(q);
+
+    if (task || atomic_load_explicit(&q->overflow_count, memory_order_acquire) == 0) {
+        return task;
+    }
+
+    /* the ring has drained, take the head of the overflow list and move as much of the rest as fits into the ring */
+    pthread_mutex_lock(&q->overflow_lock);
+
+    task = q->overflow_head;
+    if (task) {
+        q->overflow_head = task->next;
+        atomic_fetch_sub(&q->overflow_count, 1);
+
+        // read the link before the task becomes visible in the ring, someone may run it straight away
+        threaddesc *next;
+        while (q->overflow_head) {
+            next = q->overflow_head->next;
+            if (!ring_enqueue(q, q->overflow_head)) {
+                break;
+            }
+            q->overflow_head = next;
+            atomic_fetch_sub(&q->overflow_count, 1);
+        }
+
+        if (q->overflow_head == NULL) {
+            q->overflow_tail = NULL;
+        }
+    }
 
-    struct threaddesc * current_descriptor = pthread_getspecific(current_descriptor_key);
-    getcontext(&current_descriptor->threadcontext);
+    pthread_mutex_unlock(&q->overflow_lock);
 
-    // deallocate memory to avoid memory leak
-    free(current_descriptor);
-    numthreads--;
-    
-    swapcontext(&current_descriptor->threadcontext, pthread_getspecific(context_key));
+    return task;
 }
 
-/* adds a request to the IO queue, C-executer will deal with the request */
-int sut_open(char *dest) {
+/* number of tasks waiting in a ready queue, only a snapshot while other threads use it */
+static long readyqueue_depth(readyqueue *q) {
 
-    struct threaddesc * current_descriptor = pthread_getspecific(current_descriptor_key);
-    getcontext(&current_descriptor->threadcontext);
+    long depth = (long) (atomic_load(&q->enqueue_pos) - atomic_load(&q->dequeue_pos));
 
-    struct queue_entry* task = queue_new_node(current_descriptor);
+    return (depth > 0 ? depth : 0) + atomic_load(&q->overflow_count);
+}
 
-    /* create IO request, add it to IOwaitqueue */
-    struct IOrequest *request = (IOrequest *) malloc(sizeof(IOrequest));
-    request->task = task;
-    request->action = OPEN;
-    request->file = dest;
+static long long now_ns() {
 
-    struct queue_entry *entry = queue_new_node(request);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    pthread_mutex_lock(&iexec_mutex);
-    queue_insert_tail(&IOqueue, entry);
-    pthread_mutex_unlock(&iexec_mutex);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-    swapcontext(&current_descriptor->threadcontext, pthread_getspecific(context_key));
+/* push a task onto the executor's ready queue for the task's current level */
+static void executor_push(executor *exec, threaddesc *task) {
 
-    /* task resumes here, IO result should be head of IOoutqueue */
-    /* retrieve and return result form IO request */
-    struct queue_entry* IOentry = queue_pop_head(&IOoutqueue);
-    struct IOresult * res = (IOresult *) IOentry->data;
-    return res->result;
+    if (timing) {
+        task->ready_ns = now_ns();
+    }
+
+    readyqueue_push(&exec->runqueue[task->priority], task);
 }
 
-char *sut_read(int fd, char *buf, int size) {
+/* pop the oldest task from the highest non-empty level of an executor's ready queues, NULL if all are empty */
+static threaddesc *executor_pop(executor *exec) {
 
-    struct threaddesc * current_descriptor = pthread_getspecific(current_descriptor_key);
-    getcontext(&current_descriptor->threadcontext);
+    threaddesc *task;
 
-    struct queue_entry* task = queue_new_node(current_descriptor);
+    for (int level = 0; level < SUT_NUM_PRIORITIES; level++) {
+        task = readyqueue_pop(&exec->runqueue[level]);
+        if (task) {
+            return task;
+        }
+    }
 
-    /* create IO request, add it to IOwaitqueue */
-    struct IOrequest *request = (IOrequest *) malloc(sizeof(IOrequest));
-    request->task = task;
-    request->action = READ;
-    request->file_descriptor = fd;
-    request->buffer = buf;
-    request->buffer_size = size;
+    return NULL;
+}
 
-    struct queue_entry *entry = queue_new_node(request);
+/*
+Anti-starvation aging: every task waiting below its priority class goes back to the level of its class,
+so CPU-bound tasks that were demoted still get to run while higher levels stay busy.
+*/
+static void executor_age(executor *exec) {
 
-    pthread_mutex_lock(&iexec_mutex);
-    queue_insert_tail(&IOqueue, entry);
-    pthread_mutex_unlock(&iexec_mutex);
+    threaddesc *task;
 
-    swapcontext(&current_descriptor->threadcontext, pthread_getspecific(context_key));
+    for (int level = 1; level < SUT_NUM_PRIORITIES; level++) {
 
-    return buf;
+        // only what is queued now, a task whose class is this level goes straight back in
+        for (long n = readyqueue_depth(&exec->runqueue[level]); n > 0; n--) {
+            task = readyqueue_pop(&exec->runqueue[level]);
+            if (task == NULL) {
+                break;
+            }
+
+            task->priority = task->base_priority;
+            task->level_ns = 0;
+            executor_push(exec, task);
+        }
+    }
 }
 
-void sut_write(int fd, char *buf, int size) {
+/* a task that blocks (on IO, a timer or a wait queue) moves up a level, but not above its priority class */
+static void task_boost(threaddesc *task) {
 
-    struct threaddesc * current_descriptor = pthread_getspecific(current_descriptor_key);
-    getcontext(&current_descriptor->threadcontext);
+    if (task->priority > task->base_priority) {
+        task->priority--;
+    }
+    task->level_ns = 0;
+}
 
-    struct queue_entry* task = queue_new_node(current_descriptor);
+/* put a sleeping task in the slot for its wake tick, relative to where the wheel is now */
+static void wheel_insert(timer_wheel *w, threaddesc *task) {
 
-    /* create IO request, add it to IOwaitqueue */
-    struct IOrequest *request = (IOrequest *) malloc(sizeof(IOrequest));
-    request->task = task;
-    request->action = WRITE;
-    request->file_descriptor = fd;
-    request->buffer = buf;
-    request->buffer_size = size;
+    unsigned long long expires = task->wake_tick;
+    unsigned long long delta;
+    int level = 0;
 
-    struct queue_entry *entry = queue_new_node(request);
+    // a task that is already due goes in the slot processed next
+    if (expires < w->current_tick) {
+        expires = w->current_tick;
+    }
+    delta = expires - w->current_tick;
 
-    pthread_mutex_lock(&iexec_mutex);
-    queue_insert_tail(&IOqueue, entry);
-    pthread_mutex_unlock(&iexec_mutex);
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
 
-    swapcontext(&current_descriptor->threadcontext, pthread_getspecific(context_key));
+    // anything beyond the top level waits in its last slot and is re-sorted as it cascades
+    if (delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS))) {
+        expires = w->current_tick + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
 
-    memset(buf, 0, size);
+    int slot = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    task->next = w->slots[level][slot];
+    w->slots[level][slot] = task;
 }
 
-void sut_close(int fd) {
+/* move the tasks of the current slot of a level down to the levels below, and the level above too on wrap around */
+static void wheel_cascade(timer_wheel *w, int level) {
 
-    struct threaddesc * current_descriptor = pthread_getspecific(current_descriptor_key);
-    getcontext(&current_descriptor->threadcontext);
+    int slot = (w->current_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    threaddesc *task = w->slots[level][slot];
+    threaddesc *next;
 
-    struct queue_entry* task = queue_new_node(current_descriptor);
+    w->slots[level][slot] = NULL;
 
-    /* create IO request, add it to IOwaitqueue */
-    struct IOrequest *request = (IOrequest *) malloc(sizeof(IOrequest));
-    request->task = task;
-    request->action = CLOSE;
-    request->file_descriptor = fd;
+    while (task) {
+        next = task->next;
+        wheel_insert(w, task);
+        task = next;
+    }
+
+    if (slot == 0 && level + 1 < WHEEL_LEVELS) {
+        wheel_cascade(w, level + 1);
+    }
+}
 
-    struct queue_entry *entry = queue_new_node(request);
+/* run the wheel up to now_tick, making every task that is due ready on this executor */
+static void wheel_advance(executor *exec, unsigned long long now_tick) {
 
-    pthread_mutex_lock(&iexec_mutex);
-    queue_insert_tail(&IOqueue, entry);
-    pthread_mutex_unlock(&iexec_mutex);
+    timer_wheel *w = &exec->timers;
+    threaddesc *task;
+    threaddesc *next;
+
+    while (w->count > 0 && w->current_tick <= now_tick) {
+
+        if ((w->current_tick & WHEEL_MASK) == 0) {
+            wheel_cascade(w, 1);
+        }
+
+        task = w->slots[0][w->current_tick & WHEEL_MASK];
+        w->slots[0][w->current_tick & WHEEL_MASK] = NULL;
+
+        while (task) {
+            next = task->next;
+            w->count--;
+            executor_push(exec, task);
+            task = next;
+        }
+
+        w->current_tick++;
+    }
 
-    swapcontext(&current_descriptor->threadcontext, pthread_getspecific(context_key));
+    // with nothing left to time there is no point walking the empty ticks later
+    if (w->count == 0 && w->current_tick <= now_tick) {
+        w->current_tick = now_tick + 1;
+    }
 }
 
-void *iexec_scheduler() {
+/* add a task to the wheel, called by the executor once the task has switched out */
+static void wheel_add(executor *exec, threaddesc *task) {
 
-    struct queue_entry *ptr;
-    IOrequest *request;
+    timer_wheel *w = &exec->timers;
 
-    int fd;
-    int fd2;
-    int file_size;
-    FILE *fp;
+    if (w->count == 0) {
+        w->current_tick = now_ns() / TIMER_TICK_NS;
+    }
+
+    wheel_insert(w, task);
+    w->count++;
+}
 
-    while (!shutdown || !readyqueue_empty || !IOqueue_empty || numthreads > 0) {
+/* tick of the next thing the wheel has to do, a due task or a cascade that may produce one; 0 if it is empty */
+static unsigned long long wheel_next_tick(timer_wheel *w) {
 
-        pthread_mutex_lock(&iexec_mutex);
-        ptr = queue_pop_head(&IOqueue);
-        pthread_mutex_unlock(&iexec_mutex);
+    if (w->count == 0) {
+        return 0;
+    }
+
+    for (unsigned long long tick = w->current_tick; tick < w->current_tick + WHEEL_SIZE; tick++) {
+        if (w->slots[0][tick & WHEEL_MASK]) {
+            return tick;
+        }
+        if (((tick + 1) & WHEEL_MASK) == 0) {
+            return tick + 1;
+        }
+    }
 
-        if (ptr) {
+    return w->current_tick + WHEEL_SIZE;
+}
 
-            IOqueue_empty = false;
+/* number of tasks waiting in all of an executor's ready queues */
+static long executor_depth(executor *exec) {
 
-            request = (IOrequest *) ptr->data;
-            switch (request->action) {
-                case OPEN:
+    long depth = 0;
 
-                    /* open file and insert result into IOoutqueue */
-                    fd = open(request->file, O_RDWR | O_APPEND | O_CREAT, 0777);
+    for (int level = 0; level < SUT_NUM_PRIORITIES; level++) {
+        depth += readyqueue_depth(&exec->runqueue[level]);
+    }
 
-                    struct IOresult *res = (IOresult *) malloc(sizeof(IOresult));
-                    res->result=fd;
-                    res->action=OPEN;
+    return depth;
+}
 
-                    struct queue_entry * entry = queue_new_node(res);
-                    pthread_mutex_lock(&iexec_mutex);
-                    queue_insert_tail(&IOoutqueue, entry);
-                    pthread_mutex_unlock(&iexec_mutex);
+static void executor_wake(executor *exec) {
 
-                    /* add job that requested this IO service back into the ready queue */
-                    pthread_mutex_lock(&cexec_mutex);
-                    queue_insert_tail(&readyqueue, request->task);
-                    pthread_mutex_unlock(&cexec_mutex);
+    pthread_mutex_lock(&exec->idle_lock);
+    exec->wakeup = true;
+    pthread_cond_signal(&exec->idle_cond);
+    pthread_mutex_unlock(&exec->idle_lock);
+}
 
-                    break;
+static void wake_all_executors() {
 
-                case READ:
+    for (int i = 0; i < num_c_execs; i++) {
+        executor_wake(&cexecs[i]);
+    }
+}
 
-                    read(request->file_descriptor, request->buffer, request->buffer_size);
+/*
+Called after pushing work onto target's queues. If target is asleep it is woken, otherwise an idle executor
+is woken so it can steal. The fence pairs with the one in executor_idle: either the pusher sees the executor
+asleep, or the executor sees the new task when it looks one last time before sleeping.
+*/
+static void notify_executors(executor *target) {
 
-                    /* add job that requested this IO service back into the ready queue */
-                    pthread_mutex_lock(&cexec_mutex);
-                    queue_insert_tail(&readyqueue, request->task);
-                    pthread_mutex_unlock(&cexec_mutex);
+    atomic_thread_fence(memory_order_seq_cst);
 
-                    break;
+    if (atomic_load_explicit(&idle_executors, memory_order_relaxed) == 0) {
+        return;
+    }
 
-                case WRITE:
+    if (atomic_load(&target->sleeping)) {
+        executor_wake(target);
+        return;
+    }
 
-                    write(request->file_descriptor, request->buffer, request->buffer_size);
+    for (int i = 0; i < num_c_execs; i++) {
+        if (atomic_load(&cexecs[i].sleeping)) {
+            executor_wake(&cexecs[i]);
+            return;
+        }
+    }
+}
 
-                    /* add job that requested this IO service back into the ready queue */
-                    pthread_mutex_lock(&cexec_mutex);
-                    queue_insert_tail(&readyqueue, request->task);
-                    pthread_mutex_unlock(&cexec_mutex);
+/* block an executor that found nothing to run until it is woken up or its next timer is due */
+static void executor_idle(executor *exec, long long deadline) {
 
-                    break;
+    struct timespec ts;
+    bool work = false;
 
-                case CLOSE:
+    atomic_store(&exec->sleeping, true);
+    atomic_fetch_add(&idle_executors, 1);
+    atomic_thread_fence(memory_order_seq_cst);
 
-                    close(request->file_descriptor);
+    for (int i = 0; i < num_c_execs && !work; i++) {
+        work = executor_depth(&cexecs[i]) > 0;
+    }
 
-                    /* add job that requested this IO service back into the ready queue */
-                    pthread_mutex_lock(&cexec_mutex);
-                    queue_insert_tail(&readyqueue, request->task);
-                    pthread_mutex_unlock(&cexec_mutex);
+    pthread_mutex_lock(&exec->idle_lock);
+    if (!work && !(shutdown && numthreads == 0)) {
 
-                    break;
+        ts.tv_sec = deadline / 1000000000LL;
+        ts.tv_nsec = deadline % 1000000000LL;
+
+        while (!exec->wakeup) {
+            if (pthread_cond_timedwait(&exec->idle_cond, &exec->idle_lock, &ts) == ETIMEDOUT) {
+                break;
             }
+        }
+    }
+    exec->wakeup = false;
+    pthread_mutex_unlock(&exec->idle_lock);
+
+    atomic_fetch_sub(&idle_executors, 1);
+    atomic_store(&exec->sleeping, false);
+}
 
+/* take a task from another executor, trying each of them once starting with the next one along */
+static threaddesc *executor_steal(executor *thief) {
 
-        } else {
-            IOqueue_empty = true;
-            usleep(100);
+    threaddesc *task;
+
+    for (int i = 1; i < num_c_execs; i++) {
+        task = executor_pop(&cexecs[(thief->id + i) % num_c_execs]);
+        if (task) {
+            return task;
         }
     }
+
+    return NULL;
 }
 
-void *cexec_scheduler() {
+/*
+Keep the preemption signal from switching the running task out while it is inside the runtime (or anything else
+that must not be interleaved with other tasks on the same kernel thread). Does nothing outside of a task, so it
+can be used on code shared with the scheduler loop and the IEXECs.
+*/
+static threaddesc *preempt_off() {
 
-    struct queue_entry *ptr;
-    ucontext_t *current_context;
-    threaddesc *current_descriptor;
-    ucontext_t *p;
+    executor *exec = this_executor();
+    threaddesc *task = exec ? exec->running : NULL;
+
+    if (task) {
+        task->preempt_disable++;
+        atomic_signal_fence(memory_order_seq_cst);
+    }
 
-    ucontext_t parent_context;
-    pthread_setspecific(context_key, &parent_context);
+    return task;
+}
 
-    while (!shutdown || !readyqueue_empty || !IOqueue_empty || numthreads > 0) {
+void sut_yield();
 
-        pthread_mutex_lock(&cexec_mutex);
-        ptr = queue_pop_head(&readyqueue);
-        pthread_mutex_unlock(&cexec_mutex);
+/* undo preempt_off, yielding if the task's quantum ran out in between */
+static void preempt_on(threaddesc *task) {
 
+    if (task == NULL) {
+        return;
+    }
 
-        if (ptr) {
+    atomic_signal_fence(memory_order_seq_cst);
+    if (--task->preempt_disable == 0 && task->preempt_pending) {
+        task->preempt_pending = false;
+        sut_yield();
+    }
+}
 
-            readyqueue_empty = false;
-            current_descriptor = (threaddesc *) ptr->data;
-            pthread_setspecific(current_descriptor_key, current_descriptor);
+/* make a task runnable, where it last ran, else on the calling executor, else round robin */
+static void make_ready(threaddesc *task) {
 
-            swapcontext(pthread_getspecific(context_key), &current_descriptor->threadcontext);
-        
-        } else {
-            readyqueue_empty = true;
-            usleep(100);
+    threaddesc *self = preempt_off();
+    executor *exec = task->last_executor;
+
+    // a task goes back to where it last ran, a new one starts where it was created, stealing evens out the load
+    if (exec == NULL) {
+        exec = this_executor();
+    }
+    if (exec == NULL) {
+        exec = &cexecs[atomic_fetch_add(&next_executor, 1) % num_c_execs];
+    }
+
+    executor_push(exec, task);
+    notify_executors(exec);
+
+    preempt_on(self);
+}
+
+/*
+Ask for the pages of a fresh mapping to come from the calling executor's NUMA node when they are first touched,
+even if the task using them first runs somewhere else. Only done for pinned executors, which stay on one node.
+Called through the raw syscall so that libnuma is not needed; malloc'd memory is left to first touch.
+*/
+static void prefer_local_node(void *addr, size_t size) {
+
+#ifdef SYS_mbind
+    executor *exec = this_executor();
+    unsigned long nodemask;
+
+    if (exec == NULL || exec->cpu < 0 || exec->numa_node < 0 || exec->numa_node >= (int) (8 * sizeof(nodemask))) {
+        return;
+    }
+
+    nodemask = 1UL << exec->numa_node;
+    syscall(SYS_mbind, addr, size, MPOL_PREFERRED, &nodemask, 8 * sizeof(nodemask) + 1, 0);
+#endif
+}
+
+/*
+Allocate a task stack. With SUT_STACK_MMAP the stack is only reserved address space (MAP_NORESERVE) and
+pages are committed as the task first touches them, so an idle task costs the few pages at the top of its
+stack that it has actually used. If stack_guard is set there is an inaccessible page below the stack so an
+overflow faults instead of running into other memory.
+*/
+static char *stack_alloc(size_t size) {
+
+    if (stack_mode == SUT_STACK_MMAP || stack_guard) {
+        size_t guard = stack_guard ? page_size : 0;
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK;
+
+        if (stack_mode == SUT_STACK_MMAP) {
+            flags |= MAP_NORESERVE;
+        }
+
+        char *region = mmap(NULL, size + guard, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (region == MAP_FAILED) {
+            return NULL;
+        }
+
+        // stacks grow down, so the guard is the lowest page
+        if (guard) {
+            mprotect(region, guard, PROT_NONE);
         }
 
+        prefer_local_node(region + guard, size);
+
+        return region + guard;
     }
 
+    return (char *) malloc(size);
 }
 
-bool sut_create(sut_task_f fn) {
+static void stack_free(char *stack, size_t size) {
 
-    ucontext_t threadcontext;
-    threaddesc *descriptor = (threaddesc *) malloc(sizeof(threaddesc));
-    
-    getcontext(&threadcontext);
+    if (stack_mode == SUT_STACK_MMAP || stack_guard) {
+        size_t guard = stack_guard ? page_size : 0;
+        munmap(stack - guard, size + guard);
+    } else {
+        free(stack);
+    }
+}
 
-    // update relevant parts of context
-	threadcontext.uc_stack.ss_sp = (char *)malloc(THREAD_STACK_SIZE);
-	threadcontext.uc_stack.ss_size = THREAD_STACK_SIZE;
+static void task_destroy(threaddesc *task) {
+    stack_free(task->threadstack, task->stack_size);
+    free(task);
+}
 
-    threadcontext.uc_link = 0;
-	threadcontext.uc_stack.ss_flags = 0;
+/*
+Get a descriptor with a stack for a new task: from the calling executor's free list, then from the shared
+pool, and only if both are empty from malloc. Only default sized stacks are pooled.
+*/
+static threaddesc *task_alloc(size_t size) {
 
-    // when this context is switched to, fn will be called, 0 denotes that fn takes 0 args
-	makecontext(&threadcontext, fn, 0);
+    executor *exec = this_executor();
+    threaddesc *task = NULL;
 
-    descriptor->threadcontext = threadcontext;
-    descriptor->threadstack = threadcontext.uc_stack.ss_sp;
-    descriptor->threadfunc = fn;
-    descriptor->threadid = numthreads;
+    if (size == stack_size) {
 
-    struct queue_entry *new_entry = queue_new_node(descriptor);
+        if (exec && exec->free_tasks) {
+            task = exec->free_tasks;
+            exec->free_tasks = task->next;
+            exec->num_free_tasks--;
+            return task;
+        }
 
-    pthread_mutex_lock(&cexec_mutex);
-    queue_insert_tail(&readyqueue, new_entry);
-    pthread_mutex_unlock(&cexec_mutex);
+        pthread_mutex_lock(&task_pool_mutex);
+        if (task_pool) {
+            task = task_pool;
+            task_pool = task->next;
+            task_pool_size--;
+        }
+        pthread_mutex_unlock(&task_pool_mutex);
 
-    numthreads++;
+        if (task) {
+            return task;
+        }
+    }
 
-    return 1;
+    task = (threaddesc *) malloc(sizeof(threaddesc));
+    if (task == NULL) {
+        return NULL;
+    }
+    atomic_fetch_add(&tasks_allocated, 1);
 
+    task->stack_size = size;
+    task->threadstack = stack_alloc(size);
+    if (task->threadstack == NULL) {
+        free(task);
+        return NULL;
+    }
+
+    return task;
 }
 
-void sut_init() {
+/* recycle the descriptor of a task that has exited, called by its executor once it is off the task's stack */
+static void task_free(executor *exec, threaddesc *task) {
 
-    // initialize keys
-    pthread_key_create(&context_key, NULL);
-    pthread_key_create(&current_descriptor_key, NULL);
+    if (task->stack_size != stack_size) {
+        task_destroy(task);
+        return;
+    }
 
-    numthreads = 0;
+    if (exec->num_free_tasks < task_cache_size) {
+        task->next = exec->free_tasks;
+        exec->free_tasks = task;
+        exec->num_free_tasks++;
+        return;
+    }
 
-    shutdown = false;
-    readyqueue_empty = false;
-    IOqueue_empty = false;
+    // keep enough in the shared pool to refill every executor once, give the rest back
+    pthread_mutex_lock(&task_pool_mutex);
+    if (task_pool_size < task_cache_size * num_c_execs) {
+        task->next = task_pool;
+        task_pool = task;
+        task_pool_size++;
+        task = NULL;
+    }
+    pthread_mutex_unlock(&task_pool_mutex);
 
-    /* initialize queues */
-    readyqueue = queue_create();
-    queue_init(&readyqueue);
+    if (task) {
+        task_destroy(task);
+    }
+}
+
+/* bump a counter that only one thread writes, without the cost of an atomic read-modify-write */
+static void counter_inc(atomic_long *counter) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static void histogram_add(histogram *h, long long ns) {
+
+    int bucket = ns > 1 ? 63 - __builtin_clzll(ns) : 0;
+
+    if (bucket >= SUT_HIST_BUCKETS) {
+        bucket = SUT_HIST_BUCKETS - 1;
+    }
+
+    counter_inc(&h->count);
+    counter_inc(&h->buckets[bucket]);
+    atomic_store_explicit(&h->total_ns, atomic_load_explicit(&h->total_ns, memory_order_relaxed) + ns,
+                          memory_order_relaxed);
+    if (ns > atomic_load_explicit(&h->max_ns, memory_order_relaxed)) {
+        atomic_store_explicit(&h->max_ns, ns, memory_order_relaxed);
+    }
+}
+
+/* add h to a sut_histogram being summed up for sut_stats */
+static void histogram_sum(sut_histogram *sum, histogram *h) {
+
+    long long max = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+
+    sum->count += atomic_load_explicit(&h->count, memory_order_relaxed);
+    sum->total_ns += atomic_load_explicit(&h->total_ns, memory_order_relaxed);
+    if (max > sum->max_ns) {
+        sum->max_ns = max;
+    }
+    for (int i = 0; i < SUT_HIST_BUCKETS; i++) {
+        sum->buckets[i] += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+    }
+}
+
+static void trace_init(trace_buffer *trace) {
+
+    trace->events = trace_path ? malloc(TRACE_EVENTS * sizeof(trace_event)) : NULL;
+    trace->count = 0;
+    trace->dropped = 0;
+}
+
+/* record an event, once the buffer is full events are only counted so tracing never allocates on the hot path */
+static void trace_add(trace_buffer *trace, long long start, long long end, int task, int kind) {
+
+    if (trace == NULL || trace->events == NULL) {
+        return;
+    }
 
-    IOqueue = queue_create();
-    queue_init(&IOqueue);
+    if (trace->count == TRACE_EVENTS) {
+        trace->dropped++;
+        return;
+    }
+
+    trace->events[trace->count].start_ns = start;
+    trace->events[trace->count].duration_ns = end - start;
+    trace->events[trace->count].task = task;
+    trace->events[trace->count].kind = kind;
+    trace->count++;
+}
+
+/* take an IO request from the calling executor's free list, carving a new slab when it runs dry */
+static IOrequest *request_alloc() {
+
+    threaddesc *self = preempt_off();
+    executor *exec = this_executor();
+    IOrequest *request;
+
+    if (exec->free_requests == NULL) {
+        request_slab *slab = (request_slab *) malloc(sizeof(request_slab));
+        if (slab == NULL) {
+            preempt_on(self);
+            return NULL;
+        }
+
+        slab->next = exec->request_slabs;
+        exec->request_slabs = slab;
+        counter_inc(&exec->request_slabs_allocated);
+
+        for (int i = 0; i < REQUEST_SLAB_SIZE; i++) {
+            slab->requests[i].next = exec->free_requests;
+            exec->free_requests = &slab->requests[i];
+        }
+    }
+
+    request = exec->free_requests;
+    exec->free_requests = request->next;
+    request->timeout_ns = 0;
+    request->async = false;
+    request->done = false;
+    counter_inc(&exec->io_requests);
+
+    preempt_on(self);
+
+    return request;
+}
 
-    IOoutqueue = queue_create();
-    queue_init(&IOoutqueue);
+/* give a completed request back, to whichever executor the task is running on now */
+static void request_free(IOrequest *request) {
 
-    // create kernel threads
-    cexec = (pthread_t *) malloc(sizeof(pthread_t));
-    pthread_create(cexec, NULL, cexec_scheduler, NULL);
+    threaddesc *self = preempt_off();
+    executor *exec = this_executor();
 
-    if (num_c_execs == 2) {
-        cexec2 = (pthread_t *) malloc(sizeof(pthread_t));
-        pthread_create(cexec2, NULL, cexec_scheduler, NULL);
+    request->next = exec->free_requests;
+    exec->free_requests = request;
+
+    preempt_on(self);
+}
+
+/* append a request to IOqueue, iexec_mutex must be held */
+static void ioqueue_push(IOrequest *request) {
+
+    if (timing) {
+        request->queued_ns = now_ns();
+    }
+
+    request->next = NULL;
+    if (IOqueue_tail) {
+        IOqueue_tail->next = request;
+    } else {
+        IOqueue_head = request;
+    }
+    IOqueue_tail = request;
+}
+
+/* remove the request at the head of IOqueue, NULL if it is empty, iexec_mutex must be held */
+static IOrequest *ioqueue_pop() {
+
+    IOrequest *request = IOqueue_head;
+
+    if (request) {
+        IOqueue_head = request->next;
+        if (IOqueue_head == NULL) {
+            IOqueue_tail = NULL;
+        }
+
+        if (collect_stats) {
+            histogram_add(&ioqueue_wait, now_ns() - request->queued_ns);
+        }
     }
 
-    iexec = (pthread_t *) malloc(sizeof(pthread_t));
-    pthread_create(iexec, NULL, iexec_scheduler, NULL);
+    return request;
+}
+
+/*
+Swap the running task out to its C-executor. Anything that makes the task visible to other threads
+(requeueing it, handing it to IEXEC) is left to the executor, since another executor could otherwise
+resume the task before its context has been saved.
+*/
+static void switch_to_executor(int action, void *arg) {
+
+    struct threaddesc * current_descriptor = current_task();
+    executor *exec;
+
+    // the task could be preempted and moved up to here, its executor is only fixed once this is raised
+    current_descriptor->preempt_disable++;
+    atomic_signal_fence(memory_order_seq_cst);
+    exec = this_executor();
+
+    exec->post_switch = action;
+    exec->post_switch_arg = arg;
+
+    sut_context_switch(&current_descriptor->threadcontext, &exec->context);
+
+    // back, maybe on another executor
+    atomic_signal_fence(memory_order_seq_cst);
+    current_descriptor->preempt_disable--;
+}
+
+/* wake the io_uring IEXEC thread if it is blocked waiting for completions, the thread pool uses iexec_cond */
+static void uring_wakeup() {
+
+#ifdef SUT_HAVE_IO_URING
+    if (uring_active && atomic_load(&ring.sleeping)) {
+        eventfd_write(ring.wakefd, 1);
+    }
+#endif
+}
+
+/* queue a request for IEXEC and wake it */
+static void io_submit(IOrequest *request) {
+
+    threaddesc *self = preempt_off();
+
+    pthread_mutex_lock(&iexec_mutex);
+    ioqueue_push(request);
+    pthread_cond_signal(&iexec_cond);
+    pthread_mutex_unlock(&iexec_mutex);
+    uring_wakeup();
+
+    preempt_on(self);
+}
+
+/* a snapshot of the scheduler metrics, exact once sut_shutdown has returned and until the next sut_init_config */
+void sut_stats(sut_runtime_stats *stats) {
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (int i = 0; i < num_c_execs; i++) {
+        executor *exec = &cexecs[i];
+
+        stats->context_switches += atomic_load_explicit(&exec->switches, memory_order_relaxed);
+        stats->yields += atomic_load_explicit(&exec->yields, memory_order_relaxed);
+        stats->io_requests += atomic_load_explicit(&exec->io_requests, memory_order_relaxed);
+        stats->ready_tasks += executor_depth(exec);
+
+        histogram_sum(&stats->run_time, &exec->run_time);
+        histogram_sum(&stats->ready_wait, &exec->ready_wait);
+        histogram_sum(&stats->io_round_trip, &exec->io_round_trip);
+    }
+
+    histogram_sum(&stats->io_queue_wait, &ioqueue_wait);
+}
+
+/* upper bound of the bucket holding the p-th quantile (0 to 1) of a histogram */
+long long sut_histogram_percentile(const sut_histogram *h, double p) {
+
+    long rank = (long) (p * h->count);
+    long seen = 0;
+
+    for (int i = 0; i < SUT_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank || (seen == h->count && seen > 0)) {
+            long long bound = 2LL << i;
+            return bound < h->max_ns ? bound : h->max_ns;
+        }
+    }
+
+    return h->max_ns;
+}
+
+static const char *trace_name(int kind) {
+
+    static const char *runs[] = {"run", "yield", "io", "exit", "sleep", "wait", "preempted"};
+    static const char *io[] = {"open", "close", "read", "write", "readv", "writev"};
+
+    if (kind == TRACE_IDLE) {
+        return "idle";
+    }
+    if (kind >= TRACE_IO) {
+        return kind - TRACE_IO < 6 ? io[kind - TRACE_IO] : "io";
+    }
+    return kind < 7 ? runs[kind] : "run";
+}
+
+static void trace_write_thread(FILE *out, trace_buffer *trace, int tid, const char *name, bool *first) {
+
+    fprintf(out, "%s\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+            *first ? "" : ",", tid, name);
+    *first = false;
+
+    for (long i = 0; i < trace->count; i++) {
+        trace_event *e = &trace->events[i];
+        double ts = (e->start_ns - trace_epoch) / 1000.0;
+
+        if (e->kind >= TRACE_IO) {
+            // requests overlap on the io_uring IEXEC, so they are async spans rather than nested slices
+            fprintf(out, ",\n{\"ph\":\"b\",\"cat\":\"io\",\"id\":\"%d.%ld\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                    "\"name\":\"%s\",\"args\":{\"task\":%d}}",
+                    tid, i, tid, ts, trace_name(e->kind), e->task);
+            fprintf(out, ",\n{\"ph\":\"e\",\"cat\":\"io\",\"id\":\"%d.%ld\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                    "\"name\":\"%s\"}",
+                    tid, i, tid, ts + e->duration_ns / 1000.0, trace_name(e->kind));
+        } else if (e->kind == TRACE_IDLE) {
+            fprintf(out, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"idle\"}",
+                    tid, ts, e->duration_ns / 1000.0);
+        } else {
+            fprintf(out, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"task %d\","
+                    "\"args\":{\"task\":%d,\"until\":\"%s\"}}",
+                    tid, ts, e->duration_ns / 1000.0, e->task, e->task, trace_name(e->kind));
+        }
+    }
+
+    if (trace->dropped) {
+        fprintf(stderr, "sut: %s dropped %ld trace events\n", name, trace->dropped);
+    }
+}
+
+/* write every thread's events to trace_path in the Chrome trace event format (chrome://tracing, Perfetto) */
+static void trace_dump() {
+
+    FILE *out = fopen(trace_path, "w");
+    char name[32];
+    bool first = true;
+
+    if (out == NULL) {
+        perror(trace_path);
+        return;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    for (int i = 0; i < num_c_execs; i++) {
+        snprintf(name, sizeof(name), "C-executor %d", i);
+        trace_write_thread(out, &cexecs[i].trace, i, name, &first);
+    }
+    for (int i = 0; i < num_i_execs; i++) {
+        snprintf(name, sizeof(name), "IEXEC %d", i);
+        trace_write_thread(out, &iexec_traces[i], 100 + i, name, &first);
+    }
+
+    fprintf(out, "\n]}\n");
+    fclose(out);
+}
+
+/*
+Tell the kernel threads that shutdown has been called, wait for them to terminate and free the runtime. The
+executors' counters are kept until the next sut_init_config, so the statistics functions give the run's totals.
+*/
+void sut_shutdown() {
+
+    pthread_mutex_lock(&iexec_mutex);
+    shutdown = true;
+    pthread_cond_broadcast(&iexec_cond);
+    pthread_mutex_unlock(&iexec_mutex);
+    uring_wakeup();
+    wake_all_executors();
+
+    for (int i = 0; i < num_c_execs; i++) {
+        pthread_join(cexecs[i].thread, NULL);
+    }
+
+    for (int i = 0; i < num_i_execs; i++) {
+        pthread_join(iexecs[i], NULL);
+    }
+
+    if (trace_path) {
+        trace_dump();
+    }
+
+    for (int i = 0; i < num_c_execs; i++) {
+        free(cexecs[i].trace.events);
+        cexecs[i].trace.events = NULL;
+    }
+    for (int i = 0; i < num_i_execs; i++) {
+        free(iexec_traces[i].events);
+    }
+    free(iexec_traces);
+    iexec_traces = NULL;
+
+    /* every task is gone, release the recycled descriptors and stacks */
+    threaddesc *task;
+
+    for (int i = 0; i < num_c_execs; i++) {
+        while ((task = cexecs[i].free_tasks) != NULL) {
+            cexecs[i].free_tasks = task->next;
+            task_destroy(task);
+        }
+        cexecs[i].num_free_tasks = 0;
+    }
+
+    while ((task = task_pool) != NULL) {
+        task_pool = task->next;
+        task_destroy(task);
+    }
+    task_pool_size = 0;
+
+    /* and the IO request slabs */
+    request_slab *slab;
+
+    for (int i = 0; i < num_c_execs; i++) {
+        while ((slab = cexecs[i].request_slabs) != NULL) {
+            cexecs[i].request_slabs = slab->next;
+            free(slab);
+        }
+        cexecs[i].free_requests = NULL;
+    }
+
+    /* and the queues and locks, the executors stay until the next init so their counters can still be read */
+    for (int i = 0; i < num_c_execs; i++) {
+        for (int level = 0; level < SUT_NUM_PRIORITIES; level++) {
+            readyqueue_destroy(&cexecs[i].runqueue[level]);
+        }
+        pthread_mutex_destroy(&cexecs[i].idle_lock);
+        pthread_cond_destroy(&cexecs[i].idle_cond);
+    }
+
+    free(iexecs);
+    iexecs = NULL;
+    num_i_execs = 0;
+}
+
+void sut_yield() {
+
+    struct threaddesc * current_descriptor = current_task();
+
+    switch_to_executor(POST_REQUEUE, current_descriptor);
+
+}
+
+static void task_complete(threaddesc *task, void *value);
+
+void sut_exit() {
+
+    struct threaddesc * current_descriptor = current_task();
+
+    // a spawned task that exits without returning joins as NULL
+    if (current_descriptor->handle) {
+        task_complete(current_descriptor, NULL);
+    }
+
+    preempt_off();
+
+    // the IEXECs sleep until there is a request, so wake them up to notice the last task is gone
+    if (--numthreads == 0) {
+        pthread_mutex_lock(&iexec_mutex);
+        pthread_cond_broadcast(&iexec_cond);
+        pthread_mutex_unlock(&iexec_mutex);
+        uring_wakeup();
+        wake_all_executors();
+    }
+
+    // the executor recycles the descriptor and stack, we cannot free the stack we are running on
+    switch_to_executor(POST_EXIT, current_descriptor);
+}
+
+/*
+Hand a request to IEXEC through the executor and wait for it. Once the task runs again the request goes back
+to the executor's free list, and the result IEXEC left in the task's descriptor is returned (with errno set
+if it failed).
+*/
+static int submit_io(IOrequest *request) {
+
+    threaddesc *task = request->task;
+
+    switch_to_executor(POST_SUBMIT_IO, request);
+
+    request_free(request);
+
+    if (task->io_result < 0) {
+        errno = task->io_errno;
+    }
+    return task->io_result;
+}
+
+/* read or write that fails with ETIMEDOUT if the fd does not become ready within timeout_ns (0 waits forever) */
+static int timed_io(int action, int fd, char *buf, int size, long long timeout_ns) {
+
+    struct IOrequest *request = request_alloc();
+
+    if (request == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    request->task = current_task();
+    request->action = action;
+    request->file_descriptor = fd;
+    request->buffer = buf;
+    request->buffer_size = size;
+    request->timeout_ns = timeout_ns > 0 ? timeout_ns : 0;
+
+    return submit_io(request);
+}
+
+int sut_read_timeout(int fd, char *buf, int size, long long timeout_ns) {
+    return timed_io(READ, fd, buf, size, timeout_ns);
+}
+
+int sut_write_timeout(int fd, char *buf, int size, long long timeout_ns) {
+    return timed_io(WRITE, fd, buf, size, timeout_ns);
+}
+
+/* park the calling task for at least ns nanoseconds without holding its executor */
+void sut_sleep(long long ns) {
+
+    struct threaddesc * current_descriptor = current_task();
+
+    if (ns <= 0) {
+        sut_yield();
+        return;
+    }
+
+    // round up so the task never wakes early
+    current_descriptor->wake_tick = (now_ns() + ns + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+
+    switch_to_executor(POST_SLEEP, current_descriptor);
+}
+
+/* adds a request to the IO queue, C-executer will deal with the request */
+int sut_open(char *dest) {
+
+    struct threaddesc * current_descriptor = current_task();
+
+    /* create IO request, the executor adds it to IOwaitqueue */
+    struct IOrequest *request = request_alloc();
+
+    if (request == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    request->task = current_descriptor;
+    request->action = OPEN;
+    request->file = dest;
+
+    /* task resumes once IEXEC has opened the file */
+    return submit_io(request);
+}
+
+char *sut_read(int fd, char *buf, int size) {
+
+    struct threaddesc * current_descriptor = current_task();
+
+    /* create IO request, the executor adds it to IOwaitqueue */
+    struct IOrequest *request = request_alloc();
+
+    if (request == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    request->task = current_descriptor;
+    request->action = READ;
+    request->file_descriptor = fd;
+    request->buffer = buf;
+    request->buffer_size = size;
+
+    submit_io(request);
+
+    return buf;
+}
+
+void sut_write(int fd, char *buf, int size) {
+
+    struct threaddesc * current_descriptor = current_task();
+
+    /* create IO request, the executor adds it to IOwaitqueue */
+    struct IOrequest *request = request_alloc();
+
+    if (request == NULL) {
+        errno = ENOMEM;
+        return;
+    }
+
+    request->task = current_descriptor;
+    request->action = WRITE;
+    request->file_descriptor = fd;
+    request->buffer = buf;
+    request->buffer_size = size;
+
+    submit_io(request);
+
+    memset(buf, 0, size);
+}
+
+void sut_close(int fd) {
+
+    struct threaddesc * current_descriptor = current_task();
+
+    /* create IO request, the executor adds it to IOwaitqueue */
+    struct IOrequest *request = request_alloc();
+
+    if (request == NULL) {
+        errno = ENOMEM;
+        return;
+    }
+
+    request->task = current_descriptor;
+    request->action = CLOSE;
+    request->file_descriptor = fd;
+
+    submit_io(request);
+}
+
+static int vector_io(int action, int fd, const struct iovec *iov, int iovcnt) {
+
+    struct IOrequest *request = request_alloc();
+
+    if (request == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    request->task = current_task();
+    request->action = action;
+    request->file_descriptor = fd;
+    request->iov = iov;
+    request->iovcnt = iovcnt;
+
+    return submit_io(request);
+}
+
+/* read into several buffers with one request (and one readv), returns bytes read or -1 with errno set */
+int sut_readv(int fd, const struct iovec *iov, int iovcnt) {
+    return vector_io(READV, fd, iov, iovcnt);
+}
+
+/* write several buffers with one request (and one writev), returns bytes written or -1 with errno set */
+int sut_writev(int fd, const struct iovec *iov, int iovcnt) {
+    return vector_io(WRITEV, fd, iov, iovcnt);
+}
+
+/*
+Wait queues of the synchronization primitives are linked through threaddesc->next and protected by the
+primitive's guard spinlock. A task parks by adding itself to the queue with the guard held and switching to its
+executor, which drops the guard only once the task's context is saved, so a waker cannot resume it too early.
+*/
+static void guard_lock(atomic_flag *guard) {
+
+    int spins = 0;
+
+    // a task preempted while holding a guard would leave the other tasks of its executor spinning
+    preempt_off();
+
+    while (atomic_flag_test_and_set_explicit(guard, memory_order_acquire)) {
+        // the holder may be an executor the OS has descheduled, let it run
+        if (++spins > 100) {
+            sched_yield();
+            spins = 0;
+        }
+    }
+}
+
+static void guard_unlock(atomic_flag *guard) {
+
+    executor *exec = this_executor();
+
+    atomic_flag_clear_explicit(guard, memory_order_release);
+    preempt_on(exec ? exec->running : NULL);
+}
+
+static void waitq_push(sut_waitq *q, threaddesc *task) {
+
+    task->next = NULL;
+    if (q->tail) {
+        q->tail->next = task;
+    } else {
+        q->head = task;
+    }
+    q->tail = task;
+}
+
+static threaddesc *waitq_pop(sut_waitq *q) {
+
+    threaddesc *task = q->head;
+
+    if (task) {
+        q->head = task->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        task->next = NULL;
+    }
+
+    return task;
+}
+
+/* add the calling task to q and switch out, releasing guard (held by the caller) after the switch */
+static void park(sut_waitq *q, atomic_flag *guard) {
+
+    threaddesc *current_descriptor = current_task();
+
+    waitq_push(q, current_descriptor);
+    task_boost(current_descriptor);
+    switch_to_executor(POST_PARK, guard);
+
+    // the executor released the guard, this balances guard_lock
+    preempt_on(current_descriptor);
+}
+
+void sut_mutex_init(sut_mutex *mutex) {
+
+    atomic_flag_clear(&mutex->guard);
+    mutex->locked = false;
+    mutex->waiters.head = NULL;
+    mutex->waiters.tail = NULL;
+}
+
+void sut_mutex_lock(sut_mutex *mutex) {
+
+    guard_lock(&mutex->guard);
+
+    if (!mutex->locked) {
+        mutex->locked = true;
+        guard_unlock(&mutex->guard);
+        return;
+    }
+
+    // sut_mutex_unlock hands the mutex straight to us, so it is ours once we run again
+    park(&mutex->waiters, &mutex->guard);
+}
+
+bool sut_mutex_trylock(sut_mutex *mutex) {
+
+    bool acquired = false;
+
+    guard_lock(&mutex->guard);
+    if (!mutex->locked) {
+        mutex->locked = true;
+        acquired = true;
+    }
+    guard_unlock(&mutex->guard);
+
+    return acquired;
+}
+
+void sut_mutex_unlock(sut_mutex *mutex) {
+
+    threaddesc *waiter;
+
+    guard_lock(&mutex->guard);
+
+    // with waiters the mutex stays locked and passes to the first one, so a running task cannot barge past it
+    waiter = waitq_pop(&mutex->waiters);
+    if (waiter == NULL) {
+        mutex->locked = false;
+    }
+
+    guard_unlock(&mutex->guard);
+
+    if (waiter) {
+        make_ready(waiter);
+    }
+}
+
+void sut_cond_init(sut_cond *cond) {
+
+    atomic_flag_clear(&cond->guard);
+    cond->waiters.head = NULL;
+    cond->waiters.tail = NULL;
+}
+
+void sut_cond_wait(sut_cond *cond, sut_mutex *mutex) {
+
+    // holding the cond's guard across the unlock means a signal after the unlock cannot miss us
+    guard_lock(&cond->guard);
+    sut_mutex_unlock(mutex);
+    park(&cond->waiters, &cond->guard);
+
+    sut_mutex_lock(mutex);
+}
+
+void sut_cond_signal(sut_cond *cond) {
+
+    threaddesc *waiter;
+
+    guard_lock(&cond->guard);
+    waiter = waitq_pop(&cond->waiters);
+    guard_unlock(&cond->guard);
+
+    if (waiter) {
+        make_ready(waiter);
+    }
+}
+
+void sut_cond_broadcast(sut_cond *cond) {
+
+    threaddesc *waiter;
+
+    guard_lock(&cond->guard);
+    waiter = cond->waiters.head;
+    cond->waiters.head = NULL;
+    cond->waiters.tail = NULL;
+    guard_unlock(&cond->guard);
+
+    while (waiter) {
+        threaddesc *next = waiter->next;
+        waiter->next = NULL;
+        make_ready(waiter);
+        waiter = next;
+    }
+}
+
+bool sut_channel_init(sut_channel *channel, size_t capacity) {
+
+    if (capacity == 0) {
+        capacity = 1;
+    }
+
+    threaddesc *self = preempt_off();
+    channel->slots = malloc(capacity * sizeof(void *));
+    preempt_on(self);
+
+    if (channel->slots == NULL) {
+        return false;
+    }
+
+    sut_mutex_init(&channel->lock);
+    sut_cond_init(&channel->not_empty);
+    sut_cond_init(&channel->not_full);
+    channel->capacity = capacity;
+    channel->head = 0;
+    channel->count = 0;
+    channel->closed = false;
+
+    return true;
+}
+
+void sut_channel_destroy(sut_channel *channel) {
+
+    threaddesc *self = preempt_off();
+
+    free(channel->slots);
+    channel->slots = NULL;
+
+    preempt_on(self);
+}
+
+/* queue a message, waiting while the channel is full; false if the channel has been closed */
+bool sut_channel_send(sut_channel *channel, void *message) {
+
+    sut_mutex_lock(&channel->lock);
+
+    while (channel->count == channel->capacity && !channel->closed) {
+        sut_cond_wait(&channel->not_full, &channel->lock);
+    }
+
+    if (channel->closed) {
+        sut_mutex_unlock(&channel->lock);
+        return false;
+    }
+
+    channel->slots[(channel->head + channel->count) % channel->capacity] = message;
+    channel->count++;
+
+    sut_mutex_unlock(&channel->lock);
+    sut_cond_signal(&channel->not_empty);
+
+    return true;
+}
+
+/* take the oldest message, waiting while the channel is empty; false once it is closed and drained */
+bool sut_channel_recv(sut_channel *channel, void **message) {
+
+    sut_mutex_lock(&channel->lock);
+
+    while (channel->count == 0 && !channel->closed) {
+        sut_cond_wait(&channel->not_empty, &channel->lock);
+    }
+
+    if (channel->count == 0) {
+        sut_mutex_unlock(&channel->lock);
+        return false;
+    }
+
+    *message = channel->slots[channel->head];
+    channel->head = (channel->head + 1) % channel->capacity;
+    channel->count--;
+
+    sut_mutex_unlock(&channel->lock);
+    sut_cond_signal(&channel->not_full);
+
+    return true;
+}
+
+/* wake every sender and receiver; senders fail from now on, receivers get what is left */
+void sut_channel_close(sut_channel *channel) {
+
+    sut_mutex_lock(&channel->lock);
+    channel->closed = true;
+    sut_mutex_unlock(&channel->lock);
+
+    sut_cond_broadcast(&channel->not_empty);
+    sut_cond_broadcast(&channel->not_full);
+}
+
+void sut_future_init(sut_future *future) {
+
+    atomic_flag_clear(&future->guard);
+    future->ready = false;
+    future->value = NULL;
+    future->waiters.head = NULL;
+    future->waiters.tail = NULL;
+}
+
+/* complete the future and wake everyone waiting on it; false if it had already been set */
+bool sut_future_set(sut_future *future, void *value) {
+
+    threaddesc *waiter;
+
+    guard_lock(&future->guard);
+
+    if (future->ready) {
+        guard_unlock(&future->guard);
+        return false;
+    }
+
+    future->value = value;
+    future->ready = true;
+    waiter = future->waiters.head;
+    future->waiters.head = NULL;
+    future->waiters.tail = NULL;
+
+    guard_unlock(&future->guard);
+
+    while (waiter) {
+        threaddesc *next = waiter->next;
+        waiter->next = NULL;
+        make_ready(waiter);
+        waiter = next;
+    }
+
+    return true;
+}
+
+/*
+Wait for the future's value. A task parks until it is set; outside the runtime (say in main before
+sut_shutdown) there is no task to park, so the calling thread polls instead.
+*/
+void *sut_future_get(sut_future *future) {
+
+    guard_lock(&future->guard);
+
+    if (!future->ready) {
+
+        if (current_task() == NULL) {
+            guard_unlock(&future->guard);
+            while (!sut_future_ready(future)) {
+                usleep(100);
+            }
+            return future->value;
+        }
+
+        // sut_future_set wakes us after storing the value
+        park(&future->waiters, &future->guard);
+        return future->value;
+    }
+
+    guard_unlock(&future->guard);
+
+    return future->value;
+}
+
+bool sut_future_ready(sut_future *future) {
+
+    bool ready;
+
+    guard_lock(&future->guard);
+    ready = future->ready;
+    guard_unlock(&future->guard);
+
+    return ready;
+}
+
+static void handle_release(sut_handle *handle) {
+
+    threaddesc *self = preempt_off();
+
+    if (atomic_fetch_sub(&handle->refs, 1) == 1) {
+        free(handle);
+    }
+
+    preempt_on(self);
+}
+
+/* publish a spawned task's result and drop its reference to the handle */
+static void task_complete(threaddesc *task, void *value) {
+
+    sut_handle *handle = task->handle;
+
+    task->handle = NULL;
+    sut_future_set(&handle->result, value);
+    handle_release(handle);
+}
+
+/* wait for a spawned task to finish and return what it returned, the handle is gone afterwards */
+void *sut_join(sut_handle *handle) {
+
+    void *value = sut_future_get(&handle->result);
+
+    handle_release(handle);
+
+    return value;
+}
+
+/* give up the handle of a spawned task that nobody is going to join */
+void sut_detach(sut_handle *handle) {
+    handle_release(handle);
+}
+
+/*
+Completion path shared by both IO engines. A blocking call's result goes in the task's completion slot and the
+task is made ready. An async request keeps its own result and is marked done under the owner's io_guard; the
+owner only needs waking if it is parked in sut_wait_any/sut_wait_all, and it checks again what it waits for.
+*/
+static void io_complete(IOrequest *request, int result, int error) {
+
+    threaddesc *task = request->task;
+    bool wake;
+
+    if (trace_path) {
+        trace_add(thread_trace, request->queued_ns, now_ns(), task->threadid,
+                  TRACE_IO + request->action);
+    }
+
+    if (!request->async) {
+        task->io_errno = error;
+        task->io_result = result;
+        make_ready(task);
+        return;
+    }
+
+    request->result = result;
+    request->error = error;
+
+    // once done is visible the owner may free the request, and unless it is parked, exit as well
+    guard_lock(&task->io_guard);
+    request->done = true;
+    wake = task->io_parked;
+    task->io_parked = false;
+    guard_unlock(&task->io_guard);
+
+    if (wake) {
+        make_ready(task);
+    }
+}
+
+static sut_io *async_io(int action, int fd, char *buf, int size) {
+
+    struct IOrequest *request = request_alloc();
+
+    if (request == NULL) {
+        return NULL;
+    }
+
+    request->task = current_task();
+    request->action = action;
+    request->file_descriptor = fd;
+    request->buffer = buf;
+    request->buffer_size = size;
+    request->async = true;
+
+    io_submit(request);
+
+    return request;
+}
+
+/* start reading into buf and return at once; buf must stay valid until the token is finished with sut_io_result */
+sut_io *sut_read_async(int fd, char *buf, int size) {
+    return async_io(READ, fd, buf, size);
+}
+
+/* start writing buf and return at once, unlike sut_write the buffer is left as it is */
+sut_io *sut_write_async(int fd, char *buf, int size) {
+    return async_io(WRITE, fd, buf, size);
+}
+
+static bool io_done(sut_io *token) {
+    return token && token->done;
+}
+
+/*
+Park the calling task until ready(tokens, count) holds, ready being evaluated with the task's io_guard held. Each
+completion of one of its requests wakes the task once, after which it looks again.
+*/
+static void io_wait(sut_io **tokens, int count, bool (*ready)(sut_io **, int)) {
+
+    threaddesc *current_descriptor = current_task();
+
+    for (;;) {
+        guard_lock(&current_descriptor->io_guard);
+
+        if (ready(tokens, count)) {
+            guard_unlock(&current_descriptor->io_guard);
+            return;
+        }
+
+        current_descriptor->io_parked = true;
+        task_boost(current_descriptor);
+        switch_to_executor(POST_PARK, &current_descriptor->io_guard);
+        preempt_on(current_descriptor);
+    }
+}
+
+static bool any_done(sut_io **tokens, int count) {
+
+    for (int i = 0; i < count; i++) {
+        if (io_done(tokens[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool all_done(sut_io **tokens, int count) {
+
+    for (int i = 0; i < count; i++) {
+        if (tokens[i] && !io_done(tokens[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* wait until one of the requests has completed and return its index; NULL entries are skipped, -1 if all are NULL */
+int sut_wait_any(sut_io **tokens, int count) {
+
+    bool any = false;
+
+    for (int i = 0; i < count; i++) {
+        any = any || tokens[i];
+    }
+    if (!any) {
+        return -1;
+    }
+
+    io_wait(tokens, count, any_done);
+
+    for (int i = 0; i < count; i++) {
+        if (io_done(tokens[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* wait until every (non-NULL) request has completed */
+void sut_wait_all(sut_io **tokens, int count) {
+    io_wait(tokens, count, all_done);
+}
+
+/* whether a request has completed, without waiting */
+bool sut_io_done(sut_io *token) {
+
+    threaddesc *current_descriptor = current_task();
+    bool done;
+
+    guard_lock(&current_descriptor->io_guard);
+    done = io_done(token);
+    guard_unlock(&current_descriptor->io_guard);
+
+    return done;
+}
+
+/*
+Finish with a request: wait for it if needed and return what read or write returned (-1 with errno set on
+failure). The token is released, and every token has to be released this way by the task that started it.
+*/
+int sut_io_result(sut_io *token) {
+
+    int result;
+
+    sut_wait_all(&token, 1);
+
+    result = token->result;
+    if (result < 0) {
+        errno = token->error;
+    }
+    request_free(token);
+
+    return result;
+}
+
+/*
+Run a batch of reads and writes, possibly on different fds, and store each one's result (and errno) in its
+sut_io_op. The requests are queued together under one lock and the task parks once for all of them, instead of
+a queue round trip and a switch per call. Returns how many of the ops failed.
+*/
+int sut_submit_batch(sut_io_op *ops, int count) {
+
+    static const int actions[] = {READ, WRITE, READV, WRITEV};
+    threaddesc *current_descriptor = current_task();
+    IOrequest *requests[BATCH_CHUNK];
+    IOrequest *request;
+    threaddesc *self;
+    int failed = 0;
+    int n;
+
+    for (int base = 0; base < count; base += BATCH_CHUNK) {
+
+        int end = count - base < BATCH_CHUNK ? count : base + BATCH_CHUNK;
+
+        n = 0;
+        for (int i = base; i < end; i++) {
+            sut_io_op *op = &ops[i];
+
+            if (op->opcode < 0 || op->opcode >= (int) (sizeof(actions) / sizeof(actions[0]))) {
+                op->result = -1;
+                op->error = EINVAL;
+                failed++;
+                continue;
+            }
+
+            request = request_alloc();
+            if (request == NULL) {
+                op->result = -1;
+                op->error = ENOMEM;
+                failed++;
+                continue;
+            }
+
+            request->task = current_descriptor;
+            request->action = actions[op->opcode];
+            request->file_descriptor = op->fd;
+            request->buffer = op->buf;
+            request->buffer_size = op->size;
+            request->iov = op->iov;
+            request->iovcnt = op->iovcnt;
+            request->async = true;
+            request->op = op;
+            requests[n++] = request;
+        }
+
+        self = preempt_off();
+        pthread_mutex_lock(&iexec_mutex);
+        for (int i = 0; i < n; i++) {
+            ioqueue_push(requests[i]);
+        }
+        pthread_cond_broadcast(&iexec_cond);
+        pthread_mutex_unlock(&iexec_mutex);
+        uring_wakeup();
+        preempt_on(self);
+
+        sut_wait_all(requests, n);
+
+        for (int i = 0; i < n; i++) {
+            requests[i]->op->result = requests[i]->result;
+            requests[i]->op->error = requests[i]->error;
+            failed += requests[i]->result < 0;
+            request_free(requests[i]);
+        }
+    }
+
+    return failed;
+}
+
+/* for a request with a timeout, poll until the fd is ready; false (errno ETIMEDOUT) if the time runs out first */
+static bool wait_fd(IOrequest *request, short events) {
+
+    struct pollfd pfd;
+    int ready;
+
+    if (request->timeout_ns == 0) {
+        return true;
+    }
+
+    pfd.fd = request->file_descriptor;
+    pfd.events = events;
+
+    ready = poll(&pfd, 1, (int) ((request->timeout_ns + 999999) / 1000000));
+    if (ready == 0) {
+        errno = ETIMEDOUT;
+        return false;
+    }
+
+    // errors and hangups are left for the read or write to report
+    return true;
+}
+
+/* whether a queued request is a plain write small enough to be merged with others */
+static bool coalescable(IOrequest *request) {
+    return request->action == WRITE && request->timeout_ns == 0 && request->buffer_size <= COALESCE_MAX_WRITE;
+}
+
+/*
+Take the writes queued right behind first that go to the same fd, so that they can be done with a single writev.
+Only the head of IOqueue is looked at, so the order of writes is kept. iexec_mutex must be held.
+*/
+static int ioqueue_pop_writes(IOrequest *first, IOrequest **batch) {
+
+    int n = 1;
+
+    batch[0] = first;
+
+    while (n < COALESCE_MAX_IOV && IOqueue_head && coalescable(IOqueue_head)
+           && IOqueue_head->file_descriptor == first->file_descriptor) {
+        batch[n++] = ioqueue_pop();
+    }
+
+    return n;
+}
+
+/*
+Do a run of writes with one writev. Each request completes as if it had been its own write; whatever a short
+writev did not cover is written request by request.
+*/
+static void write_coalesced(IOrequest **batch, int n) {
+
+    struct iovec iov[COALESCE_MAX_IOV];
+    ssize_t written;
+    int result;
+
+    for (int i = 0; i < n; i++) {
+        iov[i].iov_base = batch[i]->buffer;
+        iov[i].iov_len = batch[i]->buffer_size;
+    }
+
+    written = writev(batch[0]->file_descriptor, iov, n);
+    if (written < 0) {
+        written = 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+
+        if (written >= batch[i]->buffer_size) {
+            result = batch[i]->buffer_size;
+            written -= result;
+        } else if (written > 0) {
+            result = written;
+            written = 0;
+        } else {
+            result = write(batch[i]->file_descriptor, batch[i]->buffer, batch[i]->buffer_size);
+        }
+
+        io_complete(batch[i], result, result < 0 ? errno : 0);
+    }
+}
+
+/*
+Any number of IEXEC threads can run this loop. Each one takes the request at the head of IOqueue, so many
+blocking calls can be in flight at once and finish in any order; the result goes straight into the descriptor
+of the task that asked for it.
+*/
+void *iexec_scheduler(void *arg) {
+
+    IOrequest *request;
+    IOrequest *batch[COALESCE_MAX_IOV];
+    int batched;
+
+    int result;
+
+    thread_trace = arg;
+
+    for (;;) {
+
+        batched = 0;
+
+        pthread_mutex_lock(&iexec_mutex);
+        while ((request = ioqueue_pop()) == NULL && !(shutdown && numthreads == 0)) {
+            pthread_cond_wait(&iexec_cond, &iexec_mutex);
+        }
+        if (request && coalesce_writes && coalescable(request)) {
+            batched = ioqueue_pop_writes(request, batch);
+        }
+        pthread_mutex_unlock(&iexec_mutex);
+
+        if (request == NULL) {
+            break;
+        }
+
+        if (batched > 1) {
+            write_coalesced(batch, batched);
+            continue;
+        }
+
+        switch (request->action) {
+            case OPEN:
+                result = open(request->file, OPEN_FLAGS, OPEN_MODE);
+                break;
+
+            case READ:
+                if (!wait_fd(request, POLLIN)) {
+                    result = -1;
+                    break;
+                }
+                result = read(request->file_descriptor, request->buffer, request->buffer_size);
+                break;
+
+            case WRITE:
+                if (!wait_fd(request, POLLOUT)) {
+                    result = -1;
+                    break;
+                }
+                result = write(request->file_descriptor, request->buffer, request->buffer_size);
+                break;
+
+            case READV:
+                result = readv(request->file_descriptor, request->iov, request->iovcnt);
+                break;
+
+            case WRITEV:
+                result = writev(request->file_descriptor, request->iov, request->iovcnt);
+                break;
+
+            case CLOSE:
+                result = close(request->file_descriptor);
+                break;
+
+            default:
+                result = -1;
+                errno = EINVAL;
+        }
+
+        io_complete(request, result, result < 0 ? errno : 0);
+    }
+
+    return NULL;
+}
+
+#ifdef SUT_HAVE_IO_URING
+/* create the rings and map them, -1 if io_uring is unavailable or too old for the opcodes used here */
+static int uring_setup(unsigned entries) {
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring.fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring.fd < 0) {
+        return -1;
+    }
+
+    // OPENAT/CLOSE/READ/WRITE and reading at the file position all arrived in 5.6, which added this feature bit
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring.fd);
+        return -1;
+    }
+
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring.cq_ring_size > ring.sq_ring_size) {
+            ring.sq_ring_size = ring.cq_ring_size;
+        }
+        ring.cq_ring_size = 0;
+    }
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring.fd, IORING_OFF_SQ_RING);
+    ring.cq_ring = ring.sq_ring;
+    if (ring.cq_ring_size) {
+        ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring.fd, IORING_OFF_CQ_RING);
+    }
+    ring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    ring.wakefd = eventfd(0, EFD_CLOEXEC);
+
+    if (ring.sq_ring == MAP_FAILED || ring.cq_ring == MAP_FAILED || ring.sqes == MAP_FAILED || ring.wakefd < 0) {
+        // the mappings go away with the ring once it is closed
+        close(ring.fd);
+        if (ring.wakefd >= 0) {
+            close(ring.wakefd);
+        }
+        return -1;
+    }
+
+    char *sq = (char *) ring.sq_ring;
+    char *cq = (char *) ring.cq_ring;
+
+    ring.sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring.sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring.sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring.sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ring.sq_entries = params.sq_entries;
+    ring.sq_local_tail = *ring.sq_tail;
+
+    ring.cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring.cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring.cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    ring.cq_entries = params.cq_entries;
+    ring.cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    ring.in_flight = 0;
+    ring.wake_armed = false;
+    atomic_init(&ring.sleeping, false);
+
+    return 0;
+}
+
+/* free submission queue entries */
+static unsigned uring_sq_space() {
+    return ring.sq_entries - (ring.sq_local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE));
+}
+
+/* next free submission queue entry, NULL if the queue is full */
+static struct io_uring_sqe *uring_get_sqe() {
+
+    unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+
+    if (ring.sq_local_tail - head >= ring.sq_entries) {
+        return NULL;
+    }
+
+    sqe = &ring.sqes[ring.sq_local_tail & ring.sq_mask];
+    ring.sq_array[ring.sq_local_tail & ring.sq_mask] = ring.sq_local_tail & ring.sq_mask;
+    ring.sq_local_tail++;
+
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/*
+Fill in submission queue entries that do the same thing iexec_scheduler would do for this request: one entry,
+or two for a read or write with a timeout, which is linked to a LINK_TIMEOUT that cancels it. Returns the
+number of entries used, the caller makes sure two are free.
+*/
+static int uring_prep(IOrequest *request) {
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+
+    switch (request->action) {
+        case OPEN:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t) request->file;
+            sqe->open_flags = OPEN_FLAGS;
+            sqe->len = OPEN_MODE;
+            break;
+
+        case READ:
+        case WRITE:
+            sqe->opcode = request->action == READ ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->fd = request->file_descriptor;
+            sqe->addr = (uintptr_t) request->buffer;
+            sqe->len = request->buffer_size;
+            sqe->off = (uint64_t) -1;
+            break;
+
+        case READV:
+        case WRITEV:
+            sqe->opcode = request->action == READV ? IORING_OP_READV : IORING_OP_WRITEV;
+            sqe->fd = request->file_descriptor;
+            sqe->addr = (uintptr_t) request->iov;
+            sqe->len = request->iovcnt;
+            sqe->off = (uint64_t) -1;
+            break;
+
+        case CLOSE:
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = request->file_descriptor;
+            break;
+    }
+
+    sqe->user_data = (uintptr_t) request;
+
+    if (request->timeout_ns == 0 || (request->action != READ && request->action != WRITE)) {
+        return 1;
+    }
+
+    sqe->flags |= IOSQE_IO_LINK;
+
+    request->timeout.tv_sec = request->timeout_ns / 1000000000LL;
+    request->timeout.tv_nsec = request->timeout_ns % 1000000000LL;
+
+    sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t) &request->timeout;
+    sqe->len = 1;
+    sqe->user_data = URING_TIMEOUT_TOKEN;
+
+    return 2;
+}
+
+/*
+IEXEC loop for the io_uring engine. Every pass moves all of IOqueue into the submission queue (as far as the
+rings have room), submits the whole batch and waits for completions with a single io_uring_enter, then puts the
+tasks whose requests completed back on the ready queues.
+*/
+void *iexec_uring_scheduler(void *arg) {
+
+    struct io_uring_sqe *sqe;
+    IOrequest *request;
+    unsigned submitted = ring.sq_local_tail;
+    unsigned head, tail;
+    bool finished, pending;
+
+    thread_trace = arg;
+
+    for (;;) {
+
+        if (!ring.wake_armed && (sqe = uring_get_sqe()) != NULL) {
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = ring.wakefd;
+            sqe->addr = (uintptr_t) &ring.wake_buffer;
+            sqe->len = sizeof(ring.wake_buffer);
+            sqe->user_data = URING_WAKE_TOKEN;
+            ring.wake_armed = true;
+            ring.in_flight++;
+        }
+
+        // never have more in flight than the completion queue can hold
+        pthread_mutex_lock(&iexec_mutex);
+        while (ring.in_flight + 2 <= ring.cq_entries && IOqueue_head && uring_sq_space() >= 2) {
+            ring.in_flight += uring_prep(ioqueue_pop());
+        }
+        finished = shutdown && numthreads == 0;
+        pthread_mutex_unlock(&iexec_mutex);
+
+        if (finished) {
+            break;
+        }
+
+        __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+
+        /* announce that we may block before the last look at IOqueue, so a new request either shows up here or wakes us */
+        atomic_store(&ring.sleeping, true);
+        pthread_mutex_lock(&iexec_mutex);
+        pending = IOqueue_head != NULL && ring.in_flight + 2 <= ring.cq_entries;
+        pthread_mutex_unlock(&iexec_mutex);
+
+        syscall(__NR_io_uring_enter, ring.fd, ring.sq_local_tail - submitted, pending ? 0 : 1,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+        atomic_store(&ring.sleeping, false);
+
+        // whatever the kernel did not take (e.g. after EINTR) goes out with the next enter
+        submitted = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+
+        head = *ring.cq_head;
+        tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & ring.cq_mask];
+
+            if (cqe->user_data == URING_WAKE_TOKEN) {
+                ring.wake_armed = false;
+            } else if (cqe->user_data != URING_TIMEOUT_TOKEN) {
+                request = (IOrequest *) (uintptr_t) cqe->user_data;
+
+                // a request cancelled by its linked timeout timed out
+                if (cqe->res == -ECANCELED && request->timeout_ns > 0) {
+                    io_complete(request, -1, ETIMEDOUT);
+                } else {
+                    io_complete(request, cqe->res < 0 ? -1 : cqe->res, cqe->res < 0 ? -cqe->res : 0);
+                }
+            }
+
+            ring.in_flight--;
+            head++;
+        }
+
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    close(ring.wakefd);
+    close(ring.fd);
+    munmap(ring.sqes, ring.sq_entries * sizeof(struct io_uring_sqe));
+    if (ring.cq_ring != ring.sq_ring) {
+        munmap(ring.cq_ring, ring.cq_ring_size);
+    }
+    munmap(ring.sq_ring, ring.sq_ring_size);
+
+    return NULL;
+}
+#endif
+
+/*
+Preemption. Each C-executor has a timer that sends PREEMPT_SIGNAL to its own thread a few times per quantum. The
+handler runs on the stack of whatever task is running; if the task has had its quantum and is at a safe point,
+the handler switches it out just like sut_yield would, and it continues from the handler when it is resumed.
+Otherwise the task is marked to yield as soon as it leaves the runtime, and a later tick may still find it at a
+safe point.
+
+A safe point is an instruction of the executable's own code (or of the vDSO, whose clock_gettime and friends keep
+no state) outside the runtime's preempt_disable regions. A task interrupted anywhere else, in libc or another
+shared library, may be holding a lock or be halfway through something that is not reentrant, like malloc, and
+switching another task in there could corrupt it. Without a dynamically linked libc the executable cannot be
+told apart from libc, so only the vDSO counts and tasks mostly yield on their way out of the runtime.
+*/
+sigset_t preempt_set;
+
+typedef struct text_range
+{
+    uintptr_t start;
+    uintptr_t end;
+} text_range;
+
+// code a task can be preempted in: the executable's and the vDSO's
+text_range preempt_text[2];
+
+static void add_text(text_range *range, struct dl_phdr_info *info) {
+
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+
+        if (ph->p_type == PT_LOAD && (ph->p_flags & PF_X)) {
+            uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+
+            if (range->end == 0 || start < range->start) {
+                range->start = start;
+            }
+            if (start + ph->p_memsz > range->end) {
+                range->end = start + ph->p_memsz;
+            }
+        }
+    }
+}
+
+static int find_text(struct dl_phdr_info *info, size_t size, void *data) {
+
+    int *objects = (int *) data;
+
+    // the executable comes first, if it has no interpreter libc is linked into it
+    if ((*objects)++ == 0) {
+        for (int i = 0; i < info->dlpi_phnum; i++) {
+            if (info->dlpi_phdr[i].p_type == PT_INTERP) {
+                add_text(&preempt_text[0], info);
+            }
+        }
+    }
+    else if (strncmp(info->dlpi_name, "linux-vdso", 10) == 0 || strncmp(info->dlpi_name, "linux-gate", 10) == 0) {
+        add_text(&preempt_text[1], info);
+    }
+
+    return 0;
+}
+
+static void preempt_find_text() {
+
+    int objects = 0;
+
+    memset(preempt_text, 0, sizeof(preempt_text));
+    dl_iterate_phdr(find_text, &objects);
+}
+
+/* whether the instruction a signal interrupted is at a safe point, as far as the code it is in goes */
+static bool preempt_safe_point(void *context) {
+
+    uintptr_t pc;
+
+#if defined(__x86_64__)
+    pc = (uintptr_t) ((ucontext_t *) context)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    pc = (uintptr_t) ((ucontext_t *) context)->uc_mcontext.pc;
+#else
+    return false;
+#endif
+
+    for (int i = 0; i < 2; i++) {
+        if (pc >= preempt_text[i].start && pc < preempt_text[i].end) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void preempt_handler(int sig, siginfo_t *info, void *context) {
+
+    int saved_errno = errno;
+    executor *exec = this_executor();
+    threaddesc *task = exec ? exec->running : NULL;
+
+    if (task == NULL || now_ns() - exec->dispatch_ns < preempt_quantum_ns) {
+        errno = saved_errno;
+        return;
+    }
+
+    if (task->preempt_disable > 0 || !preempt_safe_point(context)) {
+        task->preempt_pending = true;
+        errno = saved_errno;
+        return;
+    }
+
+    task->preemptions++;
+    counter_inc(&exec->preemptions);
+
+    switch_to_executor(POST_PREEMPT, task);
+
+    errno = saved_errno;
+}
+
+/* start or stop the executor's preemption timer, an idle executor has nothing to preempt */
+static void preempt_timer_arm(executor *exec, bool on) {
+
+    struct itimerspec its;
+    long long interval = on ? preempt_quantum_ns / PREEMPT_TICKS : 0;
+
+    if (preempt_quantum_ns == 0) {
+        return;
+    }
+
+    if (on && interval == 0) {
+        interval = 1;
+    }
+
+    its.it_interval.tv_sec = interval / 1000000000LL;
+    its.it_interval.tv_nsec = interval % 1000000000LL;
+    its.it_value = its.it_interval;
+
+    timer_settime(exec->preempt_timer, 0, &its, NULL);
+}
+
+static void preempt_timer_create(executor *exec) {
+
+    struct sigevent sev;
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = PREEMPT_SIGNAL;
+#ifdef sigev_notify_thread_id
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+#else
+    sev._sigev_un._tid = syscall(SYS_gettid);
+#endif
+
+    if (timer_create(CLOCK_MONOTONIC, &sev, &exec->preempt_timer) != 0) {
+        perror("timer_create");
+        exit(1);
+    }
+
+    preempt_timer_arm(exec, true);
+}
+
+/* a task kept its executor for longer than the preemption quantum */
+static void record_overrun(executor *exec, threaddesc *task, long long overrun) {
+
+    task->overruns++;
+    task->overrun_ns += overrun;
+    if (overrun > task->max_overrun_ns) {
+        task->max_overrun_ns = overrun;
+    }
+
+    counter_inc(&exec->overruns);
+    atomic_store_explicit(&exec->overrun_ns, atomic_load_explicit(&exec->overrun_ns, memory_order_relaxed) + overrun,
+                          memory_order_relaxed);
+    if (overrun > atomic_load_explicit(&exec->max_overrun_ns, memory_order_relaxed)) {
+        atomic_store_explicit(&exec->max_overrun_ns, overrun, memory_order_relaxed);
+    }
+}
+
+/* stop the calling task from being preempted until the matching sut_preempt_enable, calls can nest */
+void sut_preempt_disable() {
+    preempt_off();
+}
+
+void sut_preempt_enable() {
+
+    executor *exec = this_executor();
+
+    preempt_on(exec ? exec->running : NULL);
+}
+
+/* quantum statistics of the calling task */
+void sut_task_preempt_stats(sut_preempt_stats *stats) {
+
+    threaddesc *task = current_task();
+
+    stats->preemptions = task->preemptions;
+    stats->overruns = task->overruns;
+    stats->overrun_ns = task->overrun_ns;
+    stats->max_overrun_ns = task->max_overrun_ns;
+}
+
+/* quantum statistics of every task so far */
+void sut_get_preempt_stats(sut_preempt_stats *stats) {
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (int i = 0; i < num_c_execs; i++) {
+        long long max = atomic_load_explicit(&cexecs[i].max_overrun_ns, memory_order_relaxed);
+
+        stats->preemptions += atomic_load_explicit(&cexecs[i].preemptions, memory_order_relaxed);
+        stats->overruns += atomic_load_explicit(&cexecs[i].overruns, memory_order_relaxed);
+        stats->overrun_ns += atomic_load_explicit(&cexecs[i].overrun_ns, memory_order_relaxed);
+        if (max > stats->max_overrun_ns) {
+            stats->max_overrun_ns = max;
+        }
+    }
+}
+
+/* finish the action the task that just switched out asked for */
+static void finish_switch(executor *exec) {
+
+    threaddesc *task;
+
+    switch (exec->post_switch) {
+        case POST_REQUEUE:
+
+            counter_inc(&exec->yields);
+            executor_push(exec, exec->post_switch_arg);
+
+            // others can only help if there is more here than the task we are about to run again
+            if (executor_depth(exec) > 1) {
+                notify_executors(exec);
+            }
+            break;
+
+        case POST_SUBMIT_IO:
+
+            task = ((IOrequest *) exec->post_switch_arg)->task;
+            task_boost(task);
+            if (timing) {
+                task->io_submit_ns = now_ns();
+            }
+            io_submit(exec->post_switch_arg);
+            break;
+
+        case POST_EXIT:
+
+            task_free(exec, exec->post_switch_arg);
+            break;
+
+        case POST_SLEEP:
+
+            task = exec->post_switch_arg;
+            task_boost(task);
+            wheel_add(exec, task);
+            break;
+
+        case POST_PREEMPT:
+
+            // the task was switched out from the signal handler, so the signal is still blocked on this thread
+            pthread_sigmask(SIG_UNBLOCK, &preempt_set, NULL);
+            executor_push(exec, exec->post_switch_arg);
+            notify_executors(exec);
+            break;
+
+        case POST_PARK:
+
+            // the task is in a wait queue now, whoever wakes it can have it
+            atomic_flag_clear_explicit(exec->post_switch_arg, memory_order_release);
+            break;
+    }
+
+    exec->post_switch = POST_NONE;
+}
+
+/* NUMA node of the CPU the calling thread is on, -1 if the kernel won't say */
+static int current_numa_node() {
+
+    unsigned cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+        return -1;
+    }
+
+    return (int) node;
+}
+
+/* thread attributes that pin a new thread to cpu, or the defaults if cpu is -1 */
+static void thread_attr_init(pthread_attr_t *attr, int cpu) {
+
+    cpu_set_t set;
+
+    pthread_attr_init(attr);
+
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    }
+}
+
+/* start a thread pinned to *cpu, unpinned (and *cpu set to -1) if the kernel refuses the CPU */
+static int thread_start(pthread_t *thread, int *cpu, void *(*start)(void *), void *arg) {
+
+    pthread_attr_t attr;
+    int err;
+
+    thread_attr_init(&attr, *cpu);
+    err = pthread_create(thread, &attr, start, arg);
+    pthread_attr_destroy(&attr);
+
+    if (err == EINVAL && *cpu >= 0) {
+        fprintf(stderr, "sut: cannot pin a thread to CPU %d, running it unpinned\n", *cpu);
+        *cpu = -1;
+        return thread_start(thread, cpu, start, arg);
+    }
+
+    return err;
+}
+
+/* copy the CPUs of a config list the process may run on, NULL if none are left */
+static int *cpu_list(const int *cpus, int *count) {
+
+    cpu_set_t allowed;
+    int *copy;
+    int n = 0;
+
+    if (cpus == NULL || *count <= 0 || sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        *count = 0;
+        return NULL;
+    }
+
+    copy = malloc(*count * sizeof(int));
+
+    for (int i = 0; i < *count; i++) {
+        if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE && CPU_ISSET(cpus[i], &allowed)) {
+            copy[n++] = cpus[i];
+        } else {
+            fprintf(stderr, "sut: CPU %d is not available, ignored\n", cpus[i]);
+        }
+    }
+
+    *count = n;
+    if (n == 0) {
+        free(copy);
+        return NULL;
+    }
+
+    return copy;
+}
+
+void *cexec_scheduler(void *arg) {
+
+    executor *exec = (executor *) arg;
+    threaddesc *current_descriptor;
+    long long start, now, deadline, ran;
+    unsigned long long next_tick;
+
+    thread_executor = exec;
+    thread_trace = &exec->trace;
+
+    // running on its own CPU by now, so the queues are first touched on the local node
+    for (int level = 0; level < SUT_NUM_PRIORITIES; level++) {
+        readyqueue_init(&exec->runqueue[level], ready_queue_size);
+    }
+    exec->numa_node = current_numa_node();
+
+    // the barrier is only set up once sut_init_config knows how many executors started
+    pthread_mutex_lock(&executors_starting);
+    pthread_mutex_unlock(&executors_starting);
+    pthread_barrier_wait(&executors_ready);
+
+    if (preempt_quantum_ns > 0) {
+        preempt_timer_create(exec);
+    }
+
+    exec->next_aging = now_ns() + aging_interval_ns;
+
+    while (!shutdown || numthreads > 0) {
+
+        now = now_ns();
+        if (exec->timers.count > 0) {
+            wheel_advance(exec, now / TIMER_TICK_NS);
+        }
+
+        if (now >= exec->next_aging) {
+            executor_age(exec);
+            exec->next_aging = now + aging_interval_ns;
+        }
+
+        current_descriptor = executor_pop(exec);
+
+        if (current_descriptor == NULL) {
+            current_descriptor = executor_steal(exec);
+        }
+
+        if (current_descriptor) {
+
+            current_descriptor->last_executor = exec;
+
+            start = now_ns();
+            counter_inc(&exec->switches);
+
+            if (collect_stats) {
+                histogram_add(&exec->ready_wait, start - current_descriptor->ready_ns);
+                if (current_descriptor->io_submit_ns) {
+                    histogram_add(&exec->io_round_trip, start - current_descriptor->io_submit_ns);
+                }
+            }
+            current_descriptor->io_submit_ns = 0;
+
+            current_descriptor->preempt_pending = false;
+            exec->dispatch_ns = start;
+            exec->running = current_descriptor;
+
+            sut_context_switch(&exec->context, &current_descriptor->threadcontext);
+
+            exec->running = NULL;
+            ran = now_ns() - start;
+
+            if (preempt_quantum_ns > 0 && ran > preempt_quantum_ns) {
+                record_overrun(exec, current_descriptor, ran - preempt_quantum_ns);
+            }
+
+            if (collect_stats) {
+                histogram_add(&exec->run_time, ran);
+            }
+            if (trace_path) {
+                trace_add(&exec->trace, start, start + ran, current_descriptor->threadid, exec->post_switch);
+            }
+
+            /* a task that has used up its allotment on this level is demoted, the allotment doubles per level */
+            current_descriptor->level_ns += ran;
+            if (current_descriptor->level_ns >= mlfq_quantum_ns << current_descriptor->priority) {
+                if (current_descriptor->priority < SUT_NUM_PRIORITIES - 1) {
+                    current_descriptor->priority++;
+                }
+                current_descriptor->level_ns = 0;
+            }
+
+            finish_switch(exec);
+
+        } else {
+
+            /* nothing to run, sleep until another thread hands us work or the next timer is due */
+            deadline = now + IDLE_WAIT_NS;
+            next_tick = wheel_next_tick(&exec->timers);
+            if (next_tick && (long long) (next_tick * TIMER_TICK_NS) < deadline) {
+                deadline = next_tick * TIMER_TICK_NS;
+            }
+
+            preempt_timer_arm(exec, false);
+            executor_idle(exec, deadline);
+            preempt_timer_arm(exec, true);
+
+            if (trace_path) {
+                trace_add(&exec->trace, now, now_ns(), -1, TRACE_IDLE);
+            }
+        }
+
+    }
+
+    if (preempt_quantum_ns > 0) {
+        timer_delete(exec->preempt_timer);
+    }
+
+    return NULL;
+}
+
+/* first function run on a task's stack, a task that returns from its function exits as if it called sut_exit */
+static bool task_create(void *fn, void *arg, sut_handle *handle, size_t size, int priority);
+
+static void task_start(void *arg) {
+
+    threaddesc *descriptor = (threaddesc *) arg;
+
+    atomic_signal_fence(memory_order_seq_cst);
+    descriptor->preempt_disable--;
+
+    if (descriptor->handle) {
+        task_complete(descriptor, ((sut_spawn_f) descriptor->threadfunc)(descriptor->arg));
+    } else {
+        ((sut_task_f) descriptor->threadfunc)();
+    }
+    sut_exit();
+}
+
+bool sut_create(sut_task_f fn) {
+    return sut_create_with_options(fn, 0, 0);
+}
+
+/* create a task whose stack is size bytes instead of the configured stack_size, 0 means the default */
+bool sut_create_with_stack(sut_task_f fn, size_t size) {
+    return sut_create_with_options(fn, size, 0);
+}
+
+/* create a task in a priority class, 0 is the highest and SUT_NUM_PRIORITIES - 1 the lowest */
+bool sut_create_with_priority(sut_task_f fn, int priority) {
+    return sut_create_with_options(fn, 0, priority);
+}
+
+bool sut_create_with_options(sut_task_f fn, size_t size, int priority) {
+    return task_create(fn, NULL, NULL, size, priority);
+}
+
+/* run fn(arg) as a new task; the returned handle gives its result to sut_join. NULL if the task can't be made */
+sut_handle *sut_spawn(sut_spawn_f fn, void *arg) {
+
+    threaddesc *self = preempt_off();
+    sut_handle *handle = malloc(sizeof(sut_handle));
+
+    if (handle == NULL) {
+        preempt_on(self);
+        return NULL;
+    }
+
+    sut_future_init(&handle->result);
+    atomic_init(&handle->refs, 2);
+
+    if (!task_create(fn, arg, handle, 0, 0)) {
+        free(handle);
+        handle = NULL;
+    }
+
+    preempt_on(self);
+
+    return handle;
+}
+
+static bool task_create(void *fn, void *arg, sut_handle *handle, size_t size, int priority) {
+
+    threaddesc *self = preempt_off();
+
+    // mmap'd stacks are whole pages, and any stack needs room for at least the first frame
+    size = size ? (size + page_size - 1) & ~(page_size - 1) : stack_size;
+
+    threaddesc *descriptor = task_alloc(size);
+
+    if (descriptor == NULL) {
+        preempt_on(self);
+        return 0;
+    }
+
+    descriptor->threadfunc = fn;
+    descriptor->arg = arg;
+    descriptor->handle = handle;
+    atomic_flag_clear(&descriptor->io_guard);
+    descriptor->io_parked = false;
+
+    if (priority < 0) {
+        priority = 0;
+    } else if (priority >= SUT_NUM_PRIORITIES) {
+        priority = SUT_NUM_PRIORITIES - 1;
+    }
+    descriptor->base_priority = priority;
+    descriptor->priority = priority;
+    descriptor->level_ns = 0;
+
+    // task_start lifts this once the task is running
+    descriptor->preempt_disable = 1;
+    descriptor->preempt_pending = false;
+    descriptor->preemptions = 0;
+    descriptor->overruns = 0;
+    descriptor->overrun_ns = 0;
+    descriptor->max_overrun_ns = 0;
+
+    // when this context is switched to, task_start will call fn
+    sut_context_make(&descriptor->threadcontext, descriptor->threadstack, descriptor->stack_size, task_start, descriptor);
+
+    // count the task before it is queued so that it cannot exit before being counted
+    numthreads++;
+    descriptor->threadid = next_task_id++;
+    descriptor->io_submit_ns = 0;
+    descriptor->last_executor = NULL;
+
+    make_ready(descriptor);
+
+    preempt_on(self);
+
+    return 1;
+
+}
+
+/* the calling task, NULL when called from outside of a task */
+sut_task *sut_self() {
+    return current_task();
+}
+
+/* id of the calling task as used by the trace, -1 outside of a task */
+int sut_task_id() {
+
+    threaddesc *task = current_task();
+
+    return task ? task->threadid : -1;
+}
+
+/*
+Memory the calling task is holding on to: its descriptor plus the pages of its stack that are resident.
+Pages of a SUT_STACK_MMAP stack the task never touched are not counted, since they were never committed.
+*/
+size_t sut_task_footprint() {
+
+    struct threaddesc * current_descriptor = current_task();
+
+    if (current_descriptor == NULL) {
+        return 0;
+    }
+
+    // mincore works on whole pages, so widen a malloc'd stack to the pages it overlaps
+    uintptr_t start = (uintptr_t) current_descriptor->threadstack & ~(uintptr_t) (page_size - 1);
+    uintptr_t end = ((uintptr_t) current_descriptor->threadstack + current_descriptor->stack_size + page_size - 1)
+                    & ~(uintptr_t) (page_size - 1);
+    size_t pages = (end - start) / page_size;
+    size_t resident = 0;
+    unsigned char vec[256];
+
+    for (size_t done = 0; done < pages; done += sizeof(vec)) {
+        size_t n = pages - done < sizeof(vec) ? pages - done : sizeof(vec);
+
+        if (mincore((void *) (start + done * page_size), n * page_size, vec) != 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            resident += vec[i] & 1;
+        }
+    }
+
+    return sizeof(threaddesc) + resident * page_size;
+}
+
+/* allocation counters, in the steady state request_slabs and tasks_allocated stop growing while io_requests does */
+void sut_get_alloc_stats(sut_alloc_stats *stats) {
+
+    stats->io_requests = 0;
+    stats->request_slabs = 0;
+    stats->tasks_allocated = atomic_load(&tasks_allocated);
+
+    for (int i = 0; i < num_c_execs; i++) {
+        stats->io_requests += atomic_load_explicit(&cexecs[i].io_requests, memory_order_relaxed);
+        stats->request_slabs += atomic_load_explicit(&cexecs[i].request_slabs_allocated, memory_order_relaxed);
+    }
+}
+
+/* IO engine the runtime is using, SUT_IO_THREADS if io_uring was asked for but could not be set up */
+int sut_io_engine() {
+    return uring_active ? SUT_IO_URING : SUT_IO_THREADS;
+}
+
+/* tasks waiting on a priority level across all executors, a snapshot for monitoring */
+long sut_queue_depth(int level) {
+
+    long depth = 0;
+
+    if (level < 0 || level >= SUT_NUM_PRIORITIES) {
+        return 0;
+    }
+
+    for (int i = 0; i < num_c_execs; i++) {
+        depth += readyqueue_depth(&cexecs[i].runqueue[level]);
+    }
+
+    return depth;
+}
+
+void sut_config_default(sut_config *config) {
+    config->num_c_execs = 1;
+    config->ready_queue_size = READY_QUEUE_SIZE;
+    config->task_cache_size = TASK_CACHE_SIZE;
+    config->stack_guard = false;
+    config->stack_mode = SUT_STACK_MALLOC;
+    config->stack_size = THREAD_STACK_SIZE;
+    config->mlfq_quantum_ns = MLFQ_QUANTUM_NS;
+    config->aging_interval_ns = AGING_INTERVAL_NS;
+    config->coalesce_writes = false;
+    config->preempt_quantum_ns = 0;
+    config->collect_stats = false;
+    config->trace_path = NULL;
+    config->num_i_execs = 1;
+    config->io_engine = SUT_IO_THREADS;
+    config->io_uring_entries = IO_URING_ENTRIES;
+    config->cexec_cpus = NULL;
+    config->num_cexec_cpus = 0;
+    config->iexec_cpus = NULL;
+    config->num_iexec_cpus = 0;
+}
+
+void sut_init() {
+
+    sut_config config;
+    sut_config_default(&config);
+
+    sut_init_config(&config);
+}
+
+/* start count IEXEC threads running loop, each with its own trace buffer, fewer if the system runs out of threads */
+static void iexec_start(int count, void *(*loop)(void *)) {
+
+    iexecs = (pthread_t *) malloc(count * sizeof(pthread_t));
+    iexec_traces = (trace_buffer *) malloc(count * sizeof(trace_buffer));
+
+    for (num_i_execs = 0; num_i_execs < count; num_i_execs++) {
+        int cpu = iexec_cpus ? iexec_cpus[num_i_execs % num_iexec_cpus] : -1;
+        int err;
+
+        trace_init(&iexec_traces[num_i_execs]);
+        err = thread_start(&iexecs[num_i_execs], &cpu, loop, &iexec_traces[num_i_execs]);
+        if (err != 0) {
+            free(iexec_traces[num_i_execs].events);
+            fprintf(stderr, "sut: cannot start IEXEC %d: %s\n", num_i_execs, strerror(err));
+            break;
+        }
+    }
+
+    // without an IEXEC every IO call would block forever
+    if (num_i_execs == 0) {
+        exit(1);
+    }
+}
+
+void sut_init_config(const sut_config *config) {
+
+    numthreads = 0;
+    next_executor = 0;
+    idle_executors = 0;
+
+    shutdown = false;
+
+    task_cache_size = config->task_cache_size >= 0 ? config->task_cache_size : TASK_CACHE_SIZE;
+    stack_guard = config->stack_guard;
+    stack_mode = config->stack_mode;
+    page_size = sysconf(_SC_PAGESIZE);
+    stack_size = config->stack_size > 0 ? config->stack_size : THREAD_STACK_SIZE;
+    stack_size = (stack_size + page_size - 1) & ~(page_size - 1);
+    mlfq_quantum_ns = config->mlfq_quantum_ns > 0 ? config->mlfq_quantum_ns : MLFQ_QUANTUM_NS;
+    aging_interval_ns = config->aging_interval_ns > 0 ? config->aging_interval_ns : AGING_INTERVAL_NS;
+    coalesce_writes = config->coalesce_writes;
+    collect_stats = config->collect_stats;
+    trace_path = config->trace_path;
+    timing = collect_stats || trace_path;
+    trace_epoch = now_ns();
+    next_task_id = 0;
+    memset(&ioqueue_wait, 0, sizeof(ioqueue_wait));
+    preempt_quantum_ns = config->preempt_quantum_ns > 0 ? config->preempt_quantum_ns : 0;
+
+    sigemptyset(&preempt_set);
+    sigaddset(&preempt_set, PREEMPT_SIGNAL);
+
+    if (preempt_quantum_ns > 0) {
+        struct sigaction sa;
+
+        memset(&sa, 0, sizeof(sa));
+        preempt_find_text();
+
+        sa.sa_sigaction = preempt_handler;
+        sa.sa_flags = SA_RESTART | SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        sigaction(PREEMPT_SIGNAL, &sa, NULL);
+    }
+
+    /* initialize queues */
+    IOqueue_head = NULL;
+    IOqueue_tail = NULL;
+    tasks_allocated = 0;
+
+    // the previous run's executors were kept for its statistics
+    free(cexecs);
+    num_c_execs = config->num_c_execs > 0 ? config->num_c_execs : 1;
+    cexecs = (executor *) aligned_alloc(CACHE_LINE, num_c_execs * sizeof(executor));
+    memset(cexecs, 0, num_c_execs * sizeof(executor));
+
+    pthread_condattr_t condattr;
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+
+    ready_queue_size = config->ready_queue_size > 0 ? config->ready_queue_size : READY_QUEUE_SIZE;
+    free(cexec_cpus);
+    free(iexec_cpus);
+    num_cexec_cpus = config->num_cexec_cpus;
+    cexec_cpus = cpu_list(config->cexec_cpus, &num_cexec_cpus);
+    num_iexec_cpus = config->num_iexec_cpus;
+    iexec_cpus = cpu_list(config->iexec_cpus, &num_iexec_cpus);
+
+    for (int i = 0; i < num_c_execs; i++) {
+        cexecs[i].id = i;
+        cexecs[i].cpu = cexec_cpus ? cexec_cpus[i % num_cexec_cpus] : -1;
+        trace_init(&cexecs[i].trace);
+        pthread_mutex_init(&cexecs[i].idle_lock, NULL);
+        pthread_cond_init(&cexecs[i].idle_cond, &condattr);
+    }
+    pthread_condattr_destroy(&condattr);
+
+    // create kernel threads, every local queue has to exist before anyone can push to or steal from it
+    int started, err = 0;
+
+    pthread_mutex_lock(&executors_starting);
+    for (started = 0; started < num_c_execs; started++) {
+        err = thread_start(&cexecs[started].thread, &cexecs[started].cpu, cexec_scheduler, &cexecs[started]);
+        if (err != 0) {
+            fprintf(stderr, "sut: cannot start C-executor %d: %s\n", started, strerror(err));
+            break;
+        }
+    }
+
+    // run with the executors that did start, none of them has looked at num_c_execs yet
+    for (int i = started; i < num_c_execs; i++) {
+        pthread_mutex_destroy(&cexecs[i].idle_lock);
+        pthread_cond_destroy(&cexecs[i].idle_cond);
+    }
+    num_c_execs = started;
+    if (num_c_execs == 0) {
+        exit(1);
+    }
+
+    pthread_barrier_init(&executors_ready, NULL, num_c_execs + 1);
+    pthread_mutex_unlock(&executors_starting);
+    pthread_barrier_wait(&executors_ready);
+    pthread_barrier_destroy(&executors_ready);
+
+    uring_active = false;
+
+#ifdef SUT_HAVE_IO_URING
+    /* one IEXEC thread drives the whole ring, fall back to the thread pool if io_uring cannot be set up */
+    if (config->io_engine == SUT_IO_URING && uring_setup(config->io_uring_entries > 0 ? config->io_uring_entries : IO_URING_ENTRIES) == 0) {
+        uring_active = true;
+        iexec_start(1, iexec_uring_scheduler);
+        return;
+    }
+#endif
 
+    iexec_start(config->num_i_execs > 0 ? config->num_i_execs : 1, iexec_scheduler);
 }
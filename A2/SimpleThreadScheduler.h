@@ -0,0 +1,264 @@
+#ifndef SIMPLE_THREAD_SCHEDULER_H
+#define SIMPLE_THREAD_SCHEDULER_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include "sut.h"
+
+// IO engines for sut_config.io_engine
+#define SUT_IO_THREADS 0
+#define SUT_IO_URING 1
+
+// how task stacks are allocated, for sut_config.stack_mode
+#define SUT_STACK_MALLOC 0
+#define SUT_STACK_MMAP 1
+
+// priority classes / feedback queue levels, 0 is the highest
+#define SUT_NUM_PRIORITIES 4
+
+/* Runtime settings for the SUT library. sut_init() uses the values filled in by sut_config_default(). */
+typedef struct sut_config
+{
+    int num_c_execs;        // number of C-executor kernel threads (default 1)
+    int num_i_execs;        // number of I/O executor kernel threads (default 1)
+    int io_engine;          // SUT_IO_THREADS (default), or SUT_IO_URING which falls back to threads if io_uring is unavailable
+    int io_uring_entries;   // submission queue depth of the io_uring engine (default 256)
+    int ready_queue_size;   // slots in each executor's lock-free ready queue, rounded up to a power of two (default 256)
+    int task_cache_size;    // exited tasks' descriptors and stacks each executor keeps for reuse (default 64)
+    bool stack_guard;       // put an inaccessible guard page below every task stack (default false)
+    int stack_mode;         // SUT_STACK_MALLOC (default), or SUT_STACK_MMAP to reserve stacks and commit pages on first touch
+    size_t stack_size;      // bytes of stack per task, rounded up to whole pages (default 64 KiB)
+    long long mlfq_quantum_ns;      // run time a task gets on level 0 before it is demoted, doubling per level (default 2 ms)
+    long long aging_interval_ns;    // how often demoted tasks waiting to run go back to their priority class (default 100 ms)
+    bool coalesce_writes;   // thread pool IEXEC merges queued small writes to the same fd into one writev (default false)
+    long long preempt_quantum_ns;   // preempt a task that has run this long without switching out, 0 is off (default 0)
+    bool collect_stats;     // time tasks and IO requests for the sut_stats histograms (default false)
+    const char *trace_path; // record scheduling and IO events and write them here at sut_shutdown (default NULL, off)
+    const int *cexec_cpus;  // pin C-executor i to CPU cexec_cpus[i % num_cexec_cpus] (default NULL, not pinned)
+    int num_cexec_cpus;
+    const int *iexec_cpus;  // same for the IO executor threads
+    int num_iexec_cpus;
+} sut_config;
+
+/* how often tasks ran past the preemption quantum, see sut_task_preempt_stats() and sut_get_preempt_stats() */
+typedef struct sut_preempt_stats
+{
+    long preemptions;           // times a task was switched out by the timer
+    long overruns;              // dispatches that lasted longer than the quantum
+    long long overrun_ns;       // total time spent past the quantum
+    long long max_overrun_ns;   // longest single overrun
+} sut_preempt_stats;
+
+// buckets of a sut_histogram, bucket i counts values from 2^i to 2^(i+1) - 1 ns (bucket 0 also counts 0)
+#define SUT_HIST_BUCKETS 40
+
+typedef struct sut_histogram
+{
+    long count;
+    long long total_ns;
+    long long max_ns;
+    long buckets[SUT_HIST_BUCKETS];
+} sut_histogram;
+
+/* scheduler metrics summed over all executors, see sut_stats() */
+typedef struct sut_runtime_stats
+{
+    long context_switches;          // times a task was switched to
+    long yields;                    // sut_yield calls
+    long io_requests;               // IO calls made by tasks
+    long ready_tasks;               // tasks waiting in ready queues right now
+    sut_histogram run_time;         // how long a task ran each time it was switched to
+    sut_histogram ready_wait;       // from a task being made ready to it being switched to
+    sut_histogram io_round_trip;    // from a blocking IO call switching the task out to the task running again
+    sut_histogram io_queue_wait;    // time requests spent on IOqueue before an IEXEC took them
+} sut_runtime_stats;
+
+/* heap allocations made by the runtime, see sut_get_alloc_stats() */
+typedef struct sut_alloc_stats
+{
+    long io_requests;       // IO calls made by tasks
+    long request_slabs;     // slabs of IO requests taken from the heap
+    long tasks_allocated;   // task descriptors (and stacks) taken from the heap
+} sut_alloc_stats;
+
+/*
+Task-level synchronization. A task that has to wait parks in the primitive's wait queue and its executor runs
+other tasks meanwhile; it goes back on a ready queue when it is woken. Only call these from tasks.
+*/
+struct threaddesc;
+
+typedef struct sut_waitq
+{
+    struct threaddesc *head;
+    struct threaddesc *tail;
+} sut_waitq;
+
+typedef struct sut_mutex
+{
+    atomic_flag guard;      // spinlock held only while the mutex's fields are updated
+    bool locked;
+    sut_waitq waiters;
+} sut_mutex;
+
+typedef struct sut_cond
+{
+    atomic_flag guard;
+    sut_waitq waiters;
+} sut_cond;
+
+/* bounded FIFO of pointers between tasks */
+typedef struct sut_channel
+{
+    sut_mutex lock;
+    sut_cond not_empty;
+    sut_cond not_full;
+    void **slots;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool closed;
+} sut_channel;
+
+/*
+One-shot result shared between a producer, which completes it with sut_future_set (the promise side), and any
+number of tasks waiting in sut_future_get.
+*/
+typedef struct sut_future
+{
+    atomic_flag guard;
+    bool ready;
+    void *value;
+    sut_waitq waiters;
+} sut_future;
+
+// operations of a sut_io_op
+#define SUT_OP_READ 0
+#define SUT_OP_WRITE 1
+#define SUT_OP_READV 2
+#define SUT_OP_WRITEV 3
+
+/* one operation of sut_submit_batch, result and error are filled in when the batch returns */
+typedef struct sut_io_op
+{
+    int opcode;
+    int fd;
+    char *buf;                  // SUT_OP_READ and SUT_OP_WRITE
+    int size;
+    const struct iovec *iov;    // SUT_OP_READV and SUT_OP_WRITEV
+    int iovcnt;
+    int result;                 // what read, write, readv or writev returned
+    int error;                  // errno if result is -1
+} sut_io_op;
+
+/* a task, as returned by sut_self() */
+typedef struct threaddesc sut_task;
+
+/* completion token of an async read or write */
+typedef struct IOrequest sut_io;
+
+/* task started with sut_spawn, returns the value sut_join hands back */
+typedef void *(*sut_spawn_f)(void *arg);
+
+/* handle of a spawned task, to be passed to sut_join or sut_detach exactly once */
+typedef struct sut_handle sut_handle;
+
+void sut_config_default(sut_config *config);
+
+void sut_init_config(const sut_config *config);
+
+bool sut_create_with_stack(sut_task_f fn, size_t stack_size);
+
+bool sut_create_with_priority(sut_task_f fn, int priority);
+
+bool sut_create_with_options(sut_task_f fn, size_t stack_size, int priority);
+
+long sut_queue_depth(int level);
+
+int sut_io_engine();
+
+void sut_sleep(long long ns);
+
+int sut_read_timeout(int fd, char *buf, int size, long long timeout_ns);
+
+int sut_write_timeout(int fd, char *buf, int size, long long timeout_ns);
+
+void sut_mutex_init(sut_mutex *mutex);
+
+void sut_mutex_lock(sut_mutex *mutex);
+
+bool sut_mutex_trylock(sut_mutex *mutex);
+
+void sut_mutex_unlock(sut_mutex *mutex);
+
+void sut_cond_init(sut_cond *cond);
+
+void sut_cond_wait(sut_cond *cond, sut_mutex *mutex);
+
+void sut_cond_signal(sut_cond *cond);
+
+void sut_cond_broadcast(sut_cond *cond);
+
+bool sut_channel_init(sut_channel *channel, size_t capacity);
+
+void sut_channel_destroy(sut_channel *channel);
+
+bool sut_channel_send(sut_channel *channel, void *message);
+
+bool sut_channel_recv(sut_channel *channel, void **message);
+
+void sut_channel_close(sut_channel *channel);
+
+void sut_future_init(sut_future *future);
+
+bool sut_future_set(sut_future *future, void *value);
+
+void *sut_future_get(sut_future *future);
+
+bool sut_future_ready(sut_future *future);
+
+int sut_readv(int fd, const struct iovec *iov, int iovcnt);
+
+int sut_writev(int fd, const struct iovec *iov, int iovcnt);
+
+int sut_submit_batch(sut_io_op *ops, int count);
+
+sut_io *sut_read_async(int fd, char *buf, int size);
+
+sut_io *sut_write_async(int fd, char *buf, int size);
+
+int sut_wait_any(sut_io **tokens, int count);
+
+void sut_wait_all(sut_io **tokens, int count);
+
+bool sut_io_done(sut_io *token);
+
+int sut_io_result(sut_io *token);
+
+sut_handle *sut_spawn(sut_spawn_f fn, void *arg);
+
+void *sut_join(sut_handle *handle);
+
+void sut_detach(sut_handle *handle);
+
+void sut_preempt_disable();
+
+void sut_preempt_enable();
+
+void sut_task_preempt_stats(sut_preempt_stats *stats);
+
+void sut_get_preempt_stats(sut_preempt_stats *stats);
+
+void sut_stats(sut_runtime_stats *stats);
+
+long long sut_histogram_percentile(const sut_histogram *h, double p);
+
+sut_task *sut_self();
+
+int sut_task_id();
+
+size_t sut_task_footprint();
+
+void sut_get_alloc_stats(sut_alloc_stats *stats);
+
+#endif
@@ -0,0 +1,76 @@
+/*
+Microbenchmark for the task context switch. Two contexts bounce back and forth, once with sut_context_switch
+(whatever sut_context.c was compiled to use) and once with plain ucontext swapcontext for comparison.
+
+    gcc -O2 bench_context_switch.c sut_context.c -o bench_context_switch && ./bench_context_switch [iterations]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ucontext.h>
+#include "sut_context.h"
+
+#define STACK_SIZE 1024*64
+
+long iterations;
+
+sut_context main_context;
+sut_context task_context;
+
+ucontext_t main_ucontext;
+ucontext_t task_ucontext;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void sut_context_task(void *arg) {
+    for (;;) {
+        sut_context_switch(&task_context, &main_context);
+    }
+}
+
+static void ucontext_task() {
+    for (;;) {
+        swapcontext(&task_ucontext, &main_ucontext);
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    double start, elapsed;
+
+    iterations = argc > 1 ? atol(argv[1]) : 10000000;
+
+    sut_context_make(&task_context, malloc(STACK_SIZE), STACK_SIZE, sut_context_task, NULL);
+
+    start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        sut_context_switch(&main_context, &task_context);
+    }
+    elapsed = now_ns() - start;
+
+#ifdef SUT_CONTEXT_ASM
+    printf("sut_context_switch (asm): %.1f ns per switch\n", elapsed / (2 * iterations));
+#else
+    printf("sut_context_switch (ucontext): %.1f ns per switch\n", elapsed / (2 * iterations));
+#endif
+
+    getcontext(&task_ucontext);
+    task_ucontext.uc_stack.ss_sp = malloc(STACK_SIZE);
+    task_ucontext.uc_stack.ss_size = STACK_SIZE;
+    task_ucontext.uc_link = 0;
+    makecontext(&task_ucontext, ucontext_task, 0);
+
+    start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        swapcontext(&main_ucontext, &task_ucontext);
+    }
+    elapsed = now_ns() - start;
+
+    printf("swapcontext: %.1f ns per switch\n", elapsed / (2 * iterations));
+
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*
+Benchmarks for the SUT runtime's hot paths: task creation, sut_yield, the blocking IO calls and how a
+yield-heavy workload scales with the number of C-executors. Every scenario starts a fresh runtime and shuts it
+down again. Results are printed one per line as CSV (benchmark,executors,engine,ops,ns_per_op,ops_per_sec) so
+runs can be compared by a script; errors go to stderr.
+
+    gcc -O2 bench_sut.c SimpleThreadScheduler.c sut_context.c -lpthread -o bench_sut
+    ./bench_sut [scale] [tmpfs directory]
+
+scale multiplies the number of operations (default 1), the IO benchmark uses a file in the given directory
+(default /dev/shm).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include "SimpleThreadScheduler.h"
+
+#define SPAWN_TASKS 100000
+#define PINGPONG_ROUNDS 1000000
+#define IO_ROUNDS 20000
+#define SCALING_TASKS 64
+#define SCALING_YIELDS 20000
+#define MAX_EXECUTORS 8
+#define IO_LINE "0123456789abcdef\n"
+#define IO_LINE_SIZE 17
+
+long scale;
+const char *io_path;
+
+// shared with the tasks of the scenario that is running
+long ops;
+atomic_long remaining;
+long long started;
+long long finished;
+int engine_used;
+int io_failed;
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void report(const char *name, int executors, const char *engine, long count, long long elapsed) {
+
+    double ns_per_op = (double) elapsed / count;
+
+    printf("%s,%d,%s,%ld,%.1f,%.0f\n", name, executors, engine, count, ns_per_op, 1e9 / ns_per_op);
+    fflush(stdout);
+}
+
+static void start_runtime(int executors, int io_engine) {
+
+    sut_config config;
+
+    sut_config_default(&config);
+    config.num_c_execs = executors;
+    config.io_engine = io_engine;
+
+    sut_init_config(&config);
+}
+
+/* the last task of a scenario to finish stops the clock */
+static void task_done() {
+    if (atomic_fetch_sub(&remaining, 1) == 1) {
+        finished = now_ns();
+    }
+}
+
+static void empty_task() {
+    task_done();
+}
+
+static void spawner() {
+
+    started = now_ns();
+
+    for (long i = 0; i < ops; i++) {
+        sut_create(empty_task);
+    }
+}
+
+/* sut_create throughput: one task creates tasks that exit at once, timed until the last one has exited */
+static void bench_spawn(int executors) {
+
+    ops = SPAWN_TASKS * scale;
+    atomic_store(&remaining, ops);
+
+    start_runtime(executors, SUT_IO_THREADS);
+    sut_create(spawner);
+    sut_shutdown();
+
+    report("spawn", executors, "-", ops, finished - started);
+}
+
+static void ping_pong_task() {
+
+    for (long i = 0; i < ops; i++) {
+        sut_yield();
+    }
+    task_done();
+}
+
+/* two tasks on one executor yielding to each other, so each yield is a switch from one task to the other */
+static void bench_ping_pong() {
+
+    ops = PINGPONG_ROUNDS * scale;
+    atomic_store(&remaining, 2);
+
+    start_runtime(1, SUT_IO_THREADS);
+    started = now_ns();
+    sut_create(ping_pong_task);
+    sut_create(ping_pong_task);
+    sut_shutdown();
+
+    report("yield_ping_pong", 1, "-", 2 * ops, finished - started);
+}
+
+static void io_task() {
+
+    char buf[64];
+    int fd;
+
+    engine_used = sut_io_engine();
+    started = now_ns();
+
+    for (long i = 0; i < ops; i++) {
+        fd = sut_open((char *) io_path);
+        if (fd < 0) {
+            fprintf(stderr, "bench_sut: cannot open %s\n", io_path);
+            io_failed = 1;
+            break;
+        }
+
+        // a fresh fd reads from the start, the write moves the offset to the end since sut_open uses O_APPEND
+        memset(buf, 0, sizeof(buf));
+        sut_read(fd, buf, sizeof(buf));
+        if (memcmp(buf, IO_LINE, IO_LINE_SIZE) != 0) {
+            fprintf(stderr, "bench_sut: read of %s did not return the line written\n", io_path);
+            io_failed = 1;
+            sut_close(fd);
+            break;
+        }
+
+        strcpy(buf, IO_LINE);
+        sut_write(fd, buf, IO_LINE_SIZE);
+        sut_close(fd);
+    }
+
+    task_done();
+}
+
+/*
+One open, read, write and close per op, end to end through IEXEC, on a tmpfs file that starts with one line so
+every read returns data. Where io_uring is not available the runtime falls back to the thread pool; that run is
+not reported, so a row is always labelled with the engine that was measured. Neither is a run whose reads did
+not return the line.
+*/
+static void bench_io(int io_engine, const char *engine) {
+
+    FILE *file = fopen(io_path, "w");
+
+    if (file == NULL) {
+        fprintf(stderr, "bench_sut: cannot create %s\n", io_path);
+        return;
+    }
+    fputs(IO_LINE, file);
+    if (fclose(file) != 0) {
+        fprintf(stderr, "bench_sut: cannot write %s\n", io_path);
+        return;
+    }
+
+    ops = IO_ROUNDS * scale;
+    io_failed = 0;
+    atomic_store(&remaining, 1);
+
+    start_runtime(1, io_engine);
+    sut_create(io_task);
+    sut_shutdown();
+
+    unlink(io_path);
+
+    if (engine_used != io_engine) {
+        fprintf(stderr, "bench_sut: %s is not available, skipping io_round_trip for it\n", engine);
+        return;
+    }
+    if (io_failed) {
+        return;
+    }
+
+    report("io_round_trip", 1, engine, ops, finished - started);
+}
+
+static void scaling_task() {
+
+    volatile long work = 0;
+
+    for (long i = 0; i < SCALING_YIELDS * scale; i++) {
+        // a little work between yields, so executors have something to do in parallel
+        for (int j = 0; j < 100; j++) {
+            work += j;
+        }
+        sut_yield();
+    }
+
+    task_done();
+}
+
+/* many yielding tasks, throughput in yields per second as executors are added */
+static void bench_scaling(int executors) {
+
+    atomic_store(&remaining, SCALING_TASKS);
+
+    start_runtime(executors, SUT_IO_THREADS);
+    started = now_ns();
+    for (int i = 0; i < SCALING_TASKS; i++) {
+        sut_create(scaling_task);
+    }
+    sut_shutdown();
+
+    report("yield_scaling", executors, "-", SCALING_TASKS * SCALING_YIELDS * scale, finished - started);
+}
+
+int main(int argc, char *argv[]) {
+
+    static char path[256];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    scale = argc > 1 ? atol(argv[1]) : 1;
+    if (scale < 1) {
+        scale = 1;
+    }
+
+    snprintf(path, sizeof(path), "%s/bench_sut.%d", argc > 2 ? argv[2] : "/dev/shm", (int) getpid());
+    io_path = path;
+
+    printf("benchmark,executors,engine,ops,ns_per_op,ops_per_sec\n");
+
+    bench_ping_pong();
+    bench_io(SUT_IO_THREADS, "threads");
+    bench_io(SUT_IO_URING, "io_uring");
+
+    // up to twice as many executors as CPUs, to show what oversubscribing costs as well
+    for (int executors = 1; executors <= MAX_EXECUTORS && executors <= 2 * cpus; executors *= 2) {
+        bench_spawn(executors);
+        bench_scaling(executors);
+    }
+
+    return 0;
+}
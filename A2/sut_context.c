@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <string.h>
+#include "sut_context.h"
+
+#ifdef SUT_CONTEXT_ASM
+
+/* sut_context_swap(&from->sp, to->sp) saves the callee-saved registers on the current stack and switches stacks */
+void sut_context_swap(void **from_sp, void *to_sp);
+
+/* first code run on a new context, calls entry(arg) with entry and arg taken from callee-saved registers */
+void sut_context_trampoline(void);
+
+#if defined(__x86_64__)
+
+/*
+Frame left on a stack that is switched away from, from the lowest address up:
+    mxcsr and x87 control word (8 bytes), r15, r14, r13, r12, rbx, rbp, return address
+*/
+__asm__(
+    ".text\n"
+    ".globl sut_context_swap\n"
+    ".type sut_context_swap, @function\n"
+    "sut_context_swap:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size sut_context_swap, .-sut_context_swap\n"
+    "\n"
+    ".globl sut_context_trampoline\n"
+    ".type sut_context_trampoline, @function\n"
+    "sut_context_trampoline:\n"
+    "    movq %r13, %rdi\n"
+    "    callq *%r12\n"
+    "    ud2\n"
+    ".size sut_context_trampoline, .-sut_context_trampoline\n"
+);
+
+void sut_context_make(sut_context *ctx, void *stack, size_t stack_size, void (*entry)(void *), void *arg) {
+
+    // after the swap's ret the stack pointer has to be 16 byte aligned, as it is right before a call
+    uintptr_t top = ((uintptr_t) stack + stack_size - 16) & ~(uintptr_t) 15;
+    uint64_t *frame = (uint64_t *) (top - 8 * 8);
+
+    memset(frame, 0, 8 * 8);
+    ((uint32_t *) frame)[0] = 0x1F80;                   // default mxcsr
+    ((uint16_t *) frame)[2] = 0x037F;                   // default x87 control word
+    frame[3] = (uint64_t) (uintptr_t) arg;              // r13
+    frame[4] = (uint64_t) (uintptr_t) entry;            // r12
+    frame[7] = (uint64_t) (uintptr_t) sut_context_trampoline;
+
+    ctx->sp = frame;
+}
+
+#elif defined(__aarch64__)
+
+/*
+Frame left on a stack that is switched away from, from the lowest address up:
+    x19-x28, x29 (frame pointer), x30 (return address), d8-d15
+*/
+__asm__(
+    ".text\n"
+    ".globl sut_context_swap\n"
+    ".type sut_context_swap, %function\n"
+    "sut_context_swap:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size sut_context_swap, .-sut_context_swap\n"
+    "\n"
+    ".globl sut_context_trampoline\n"
+    ".type sut_context_trampoline, %function\n"
+    "sut_context_trampoline:\n"
+    "    mov x0, x20\n"
+    "    blr x19\n"
+    "    brk #0\n"
+    ".size sut_context_trampoline, .-sut_context_trampoline\n"
+);
+
+void sut_context_make(sut_context *ctx, void *stack, size_t stack_size, void (*entry)(void *), void *arg) {
+
+    uintptr_t top = ((uintptr_t) stack + stack_size) & ~(uintptr_t) 15;
+    uint64_t *frame = (uint64_t *) (top - 160);
+
+    memset(frame, 0, 160);
+    frame[0] = (uint64_t) (uintptr_t) entry;            // x19
+    frame[1] = (uint64_t) (uintptr_t) arg;              // x20
+    frame[11] = (uint64_t) (uintptr_t) sut_context_trampoline;  // x30
+
+    ctx->sp = frame;
+}
+
+#endif
+
+void sut_context_switch(sut_context *from, sut_context *to) {
+    sut_context_swap(&from->sp, to->sp);
+}
+
+#else
+
+/* makecontext only passes int arguments, so the entry point and its argument are split into 32 bit halves */
+static void ucontext_trampoline(unsigned entry_hi, unsigned entry_lo, unsigned arg_hi, unsigned arg_lo) {
+
+    void (*entry)(void *) = (void (*)(void *)) (uintptr_t) (((uint64_t) entry_hi << 32) | entry_lo);
+    void *arg = (void *) (uintptr_t) (((uint64_t) arg_hi << 32) | arg_lo);
+
+    entry(arg);
+}
+
+void sut_context_make(sut_context *ctx, void *stack, size_t stack_size, void (*entry)(void *), void *arg) {
+
+    uint64_t e = (uint64_t) (uintptr_t) entry;
+    uint64_t a = (uint64_t) (uintptr_t) arg;
+
+    getcontext(&ctx->uc);
+
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = stack_size;
+    ctx->uc.uc_stack.ss_flags = 0;
+    ctx->uc.uc_link = 0;
+
+    makecontext(&ctx->uc, (void (*)()) ucontext_trampoline, 4,
+                (unsigned) (e >> 32), (unsigned) e, (unsigned) (a >> 32), (unsigned) a);
+}
+
+void sut_context_switch(sut_context *from, sut_context *to) {
+    swapcontext(&from->uc, &to->uc);
+}
+
+#endif
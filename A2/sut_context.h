@@ -0,0 +1,35 @@
+#ifndef SUT_CONTEXT_H
+#define SUT_CONTEXT_H
+
+#include <stddef.h>
+
+/*
+Execution contexts for SUT tasks. On x86-64 and aarch64 a context is just a saved stack pointer: the switch
+pushes the callee-saved registers onto the old stack and pops them off the new one, without any syscall.
+Anywhere else, or when compiled with -DSUT_USE_UCONTEXT, contexts fall back to getcontext/makecontext/swapcontext.
+*/
+#if !defined(SUT_USE_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#define SUT_CONTEXT_ASM 1
+
+typedef struct sut_context
+{
+    void *sp;
+} sut_context;
+
+#else
+#include <ucontext.h>
+
+typedef struct sut_context
+{
+    ucontext_t uc;
+} sut_context;
+
+#endif
+
+/* prepare ctx so that switching to it calls entry(arg) on the given stack, entry must never return */
+void sut_context_make(sut_context *ctx, void *stack, size_t stack_size, void (*entry)(void *), void *arg);
+
+/* save the running context in from and resume to */
+void sut_context_switch(sut_context *from, sut_context *to);
+
+#endif